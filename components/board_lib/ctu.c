@@ -1,4 +1,5 @@
 #include <string.h>
+#include <stdlib.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
@@ -11,39 +12,93 @@
 #include "board_lib.h"
 #include "ntxfr.h"
 
-#define READER_UART UART_NUM_1
 #define CTU_CMD_SELECT 0x12
+/* incomplete frame is dropped after this time without data */
+#define CTU_IDLE_TIMEOUT pdMS_TO_TICKS(500)
+/* UART signals received data after line is idle for this many symbol times */
+#define CTU_RX_TIMEOUT 3
+/* driver RX ring holds two full frames, must exceed hardware FIFO */
+#define CTU_RX_RING_SIZE (2*(NTXFR_MAX_FRAME_LEN + 1))
+_Static_assert(CTU_RX_RING_SIZE > UART_FIFO_LEN, "UART RX ring must exceed FIFO");
+/* recently seen cards remembered for repeat suppression */
+#define CTU_RECENT_CARDS 4
+#define CTU_DEBOUNCE pdMS_TO_TICKS(CONFIG_BOARD_READER_DEBOUNCE)
+/* select response must arrive in this time */
+#define CTU_POLL_TIMEOUT pdMS_TO_TICKS(CONFIG_BOARD_READER_TIMEOUT)
+
+/* recently seen card */
+typedef struct {
+	uint64_t card_id;
+	TickType_t tick;
+} ctu_recent_card_t;
+
+/* reader instance */
+struct ctu_reader {
+	board_reader_config_t config;
+	esp_event_loop_handle_t event_loop;
+	TaskHandle_t task_handle;
+	ntxfr_parser_t parser;
+	board_reader_stats_t stats;
+	TickType_t rx_tick; /* last data received */
+	ctu_recent_card_t recent[CTU_RECENT_CARDS];
+#ifdef CONFIG_BOARD_READER_POLL
+	bool poll_pending; /* select sent, waiting for response */
+	TickType_t poll_tick; /* select sent or next one due */
+	TickType_t poll_interval;
+	uint32_t poll_misses; /* consecutive missing responses */
+#endif
+	uint8_t rx_buf[NTXFR_MAX_FRAME_LEN];
+};
 
 static void ctu_task(void *arg);
+static void ctu_gpio_init(board_reader_t reader);
+static void ctu_handle_frame(const ntxfr_frame_t *ntx_frame, void *arg);
+static bool ctu_is_repeat(board_reader_t reader, uint64_t card_id);
+#ifdef CONFIG_BOARD_READER_POLL
+static TickType_t ctu_poll(board_reader_t reader);
+static void ctu_poll_response(board_reader_t reader, bool card);
+static void ctu_power_cycle(board_reader_t reader);
+#endif
 
 static const char *ctu_tag = "ctu";
 
-static TaskHandle_t ctu_task_handle;
-static esp_event_loop_handle_t ctu_event_loop;
-
-/* inits reader and starts reader task, posts codes to the provided event loop */
-void board_reader_start(esp_event_loop_handle_t event_loop, UBaseType_t task_priority)
+/* inits reader and starts its task, posts card ids tagged with reader id to the provided event loop */
+board_reader_t board_reader_start(const board_reader_config_t *config, esp_event_loop_handle_t event_loop, UBaseType_t task_priority)
 {
+	board_reader_t reader;
 	BaseType_t ret;
 
-	ctu_event_loop = event_loop;
-	ret = xTaskCreate(ctu_task, ctu_tag, 2048 + configMINIMAL_STACK_SIZE, NULL, task_priority, &ctu_task_handle);
+	reader = calloc(1, sizeof(struct ctu_reader));
+	ESP_ERROR_CHECK(reader == NULL ? ESP_ERR_NO_MEM : ESP_OK);
+	reader->config = *config;
+	reader->event_loop = event_loop;
+	ret = xTaskCreate(ctu_task, ctu_tag, 2048 + configMINIMAL_STACK_SIZE, reader, task_priority, &reader->task_handle);
 	ESP_ERROR_CHECK(ret != pdPASS ? ESP_ERR_NO_MEM : ESP_OK);
+	return(reader);
+}
+
+/* copies reader statistics */
+void board_reader_get_stats(board_reader_t reader, board_reader_stats_t *stats)
+{
+	*stats = reader->stats;
+	stats->resyncs = reader->parser.resyncs;
 }
 
 static void ctu_task(void *arg)
 {
+	board_reader_t reader = arg;
+	uart_port_t uart = reader->config.uart;
 	uart_config_t uart_conf;
-	size_t i;
-	size_t code_pos;
-	uint8_t *code_buf = NULL;
+	size_t pending;
+	size_t chunk;
+	int read_len;
 	uart_event_t uart_event;
 	QueueHandle_t uart_queue;
-	uint8_t read_data;
-	ntxfr_data_t ntx_data;
-	uint64_t card_id;
-
-	(void)arg;
+	TickType_t wait;
+	TickType_t idle;
+#ifdef CONFIG_BOARD_READER_POLL
+	TickType_t poll_wait;
+#endif
 
 	/* interface */
 	uart_conf.baud_rate = 115200;
@@ -53,87 +108,244 @@ static void ctu_task(void *arg)
 	uart_conf.source_clk = UART_SCLK_APB;
 	uart_conf.stop_bits = UART_STOP_BITS_1;
 	uart_conf.rx_flow_ctrl_thresh = 64;
-	ESP_ERROR_CHECK(uart_param_config(READER_UART, &uart_conf));
-	ESP_ERROR_CHECK(uart_driver_install(READER_UART, 2*(CONFIG_MAX_CODE_LEN + 2), 0, 2, &uart_queue, 0)); /* 0 buffer for TX - block until completion */
-	ESP_ERROR_CHECK(uart_set_pin(READER_UART, CONFIG_BOARD_READER_TXD_GPIO, CONFIG_BOARD_READER_RXD_GPIO, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+	ESP_ERROR_CHECK(uart_param_config(uart, &uart_conf));
+	ESP_ERROR_CHECK(uart_driver_install(uart, CTU_RX_RING_SIZE, 0, 2, &uart_queue, 0)); /* 0 buffer for TX - block until completion */
+	ESP_ERROR_CHECK(uart_set_pin(uart, reader->config.tx_gpio, reader->config.rx_gpio, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
 
-	ESP_ERROR_CHECK(uart_flush(READER_UART));
-	
-	/* alocate space for code */
-	code_buf = malloc(CONFIG_MAX_CODE_LEN+1);
-	ESP_ERROR_CHECK(code_buf == NULL ? ESP_ERR_NO_MEM : ESP_OK);
-	ntx_data.ptr = code_buf;
+	ESP_ERROR_CHECK(uart_set_rx_timeout(uart, CTU_RX_TIMEOUT));
+
+	ESP_ERROR_CHECK(uart_flush(uart));
+	ctu_gpio_init(reader);
 
 	/* main reader loop */
-	code_pos = 0;
+	ntxfr_parser_reset(&reader->parser);
+#ifdef CONFIG_BOARD_READER_POLL
+	reader->poll_interval = pdMS_TO_TICKS(CONFIG_BOARD_READER_POLL_MIN);
+	reader->poll_tick = xTaskGetTickCount();
+#endif
 	while(true)
 	{
-		if(xQueueReceive(uart_queue, (void *)&uart_event, pdMS_TO_TICKS(500)))
+		/* sleep until UART signals data, wake up on idle only to drop incomplete frame */
+		wait = portMAX_DELAY;
+		if(reader->parser.pos)
+		{
+			idle = xTaskGetTickCount() - reader->rx_tick;
+			wait = idle < CTU_IDLE_TIMEOUT ? CTU_IDLE_TIMEOUT - idle : 0;
+		}
+#ifdef CONFIG_BOARD_READER_POLL
+		/* or when next select command is due */
+		poll_wait = ctu_poll(reader);
+		if(poll_wait < wait)
+			wait = poll_wait;
+#endif
+		if(xQueueReceive(uart_queue, (void *)&uart_event, wait))
 		{
 			switch(uart_event.type)
 			{
 			case UART_DATA:
-				for(i=0; i<uart_event.size; i++)
+				/* read in bulk, frames are handled as soon as their last byte arrives */
+				pending = uart_event.size;
+				reader->rx_tick = xTaskGetTickCount();
+				while(pending)
 				{
-					uart_read_bytes(READER_UART, &read_data, 1, portMAX_DELAY);
-					if(code_pos >= CONFIG_MAX_CODE_LEN) /* oversized */
-					{
-						ESP_LOGW(ctu_tag, "Oversized code");
-						code_pos = 0; /* search again */
-					}
-					else /* continue */
-					{
-						code_buf[code_pos] = read_data;
-						code_pos++;
-					}
+					chunk = pending < sizeof(reader->rx_buf) ? pending : sizeof(reader->rx_buf);
+					read_len = uart_read_bytes(uart, reader->rx_buf, chunk, portMAX_DELAY);
+					if(read_len <= 0) /* driver error */
+						break;
+					pending -= read_len;
+					ntxfr_parser_feed(&reader->parser, reader->rx_buf, read_len, ctu_handle_frame, reader);
 				}
 				break;
 			case UART_FIFO_OVF:
 			case UART_BUFFER_FULL:
-				ESP_LOGW(ctu_tag, "UART overflow");
-				ESP_ERROR_CHECK(uart_flush_input(READER_UART));
+				ESP_LOGW(ctu_tag, "Reader %u UART overflow", reader->config.id);
+				reader->stats.overflows++;
+				ESP_ERROR_CHECK(uart_flush_input(uart));
 				xQueueReset(uart_queue);
+				ntxfr_parser_reset(&reader->parser);
 				break;
 			default:
 				ESP_LOGD(ctu_tag, "UART event type: %d", uart_event.type);
 			}
 		} else {
-			/* no data received */
-			if(code_pos > 0) /* data ready to parse */
+			/* no data received, drop incomplete frame */
+			if(reader->parser.pos > 0 && xTaskGetTickCount() - reader->rx_tick >= CTU_IDLE_TIMEOUT)
 			{
-				ntx_data.len = code_pos;
-				if (ntxfr_is_valid(ntx_data))
-				{
-					if (ntxfr_get_res(ntx_data) == (CTU_CMD_SELECT + 1))
-					{
-						ntxfr_data_t ctu_id_data;
-						ctu_id_data = ntxfr_get_data(ntx_data);
-						if (ctu_id_data.len == 1 + 5)
-						{
-							/* no colisions and valid ID length */
-							int i;
-							/* report new card */
-							card_id = 0;
-							for(i = 0; i < ctu_id_data.len - 1; i++) {
-								ESP_LOGD(ctu_tag, "0x%x", ctu_id_data.ptr[i]);
-								card_id += ((uint64_t)ctu_id_data.ptr[i]) << (8 * i);
-							}
-							ESP_LOGD(ctu_tag, "Received card ID: %llu", card_id);
-							ESP_ERROR_CHECK(esp_event_post_to(ctu_event_loop, BOARD_EVENT, BOARD_EVENT_NEW_CARD, &card_id, sizeof(card_id), portMAX_DELAY));
-						} else {
-							/* unsupported card id data length */
-							ESP_LOGD(ctu_tag, "Card ID len: %d unsupported or colision: %d", ctu_id_data.len, ctu_id_data.ptr[0]);
-						}
-					} else {
-						/* unexpected response */
-						ESP_LOGD(ctu_tag, "Unexpected response: %x", ntxfr_get_res(ntx_data));
-					}
-				} else {
-					// ESP_LOGW(ctu_tag, "Received invalid frame. cCRC: %x, hCRC: %x, len: %d", calc_crc(ntx_data), get_crc(ntx_data), get_len(ntx_data.ptr));
-					ESP_LOGW(ctu_tag, "Received invalid frame.");
-				}
-				code_pos = 0; /* load buffer again */
+				ESP_LOGW(ctu_tag, "Reader %u received incomplete frame.", reader->config.id);
+				reader->stats.incomplete_frames++;
+				ntxfr_parser_flush(&reader->parser, ctu_handle_frame, reader);
 			}
 		}
 	}
-}
\ No newline at end of file
+}
+
+/* reports card id from select response */
+static void ctu_handle_frame(const ntxfr_frame_t *ntx_frame, void *arg)
+{
+	board_reader_t reader = arg;
+	board_card_event_t card_event;
+	ntxfr_data_t ctu_id_data;
+	int i;
+
+	reader->stats.frames++;
+	if (ntx_frame->cmd == (CTU_CMD_SELECT + 1))
+	{
+		ctu_id_data = ntx_frame->data;
+#ifdef CONFIG_BOARD_READER_POLL
+		ctu_poll_response(reader, ctu_id_data.len == 1 + 5);
+#endif
+		if (ctu_id_data.len == 1 + 5)
+		{
+			/* no colisions and valid ID length */
+			/* report new card */
+			card_event.card_id = 0;
+			card_event.reader_id = reader->config.id;
+			for(i = 0; i < ctu_id_data.len - 1; i++) {
+				ESP_LOGD(ctu_tag, "0x%x", ctu_id_data.ptr[i]);
+				card_event.card_id += ((uint64_t)ctu_id_data.ptr[i]) << (8 * i);
+			}
+			ESP_LOGD(ctu_tag, "Reader %u received card ID: %llu", card_event.reader_id, card_event.card_id);
+			reader->stats.cards++;
+			if(ctu_is_repeat(reader, card_event.card_id)) /* card still held on reader */
+			{
+				reader->stats.suppressed++;
+				return;
+			}
+			ESP_ERROR_CHECK(esp_event_post_to(reader->event_loop, BOARD_EVENT, BOARD_EVENT_NEW_CARD, &card_event, sizeof(card_event), portMAX_DELAY));
+		} else {
+			/* unsupported card id data length */
+			ESP_LOGD(ctu_tag, "Card ID len: %d unsupported or colision: %d", ctu_id_data.len, ctu_id_data.len ? ctu_id_data.ptr[0] : 0);
+		}
+	} else {
+		/* unexpected response */
+		ESP_LOGD(ctu_tag, "Unexpected response: %x", ntx_frame->cmd);
+	}
+}
+
+/* remembers card, true if it was seen within debounce window, window restarts on every sighting */
+static bool ctu_is_repeat(board_reader_t reader, uint64_t card_id)
+{
+	ctu_recent_card_t *entry;
+	ctu_recent_card_t *victim;
+	TickType_t now;
+	bool repeat;
+	size_t i;
+
+	if(!CTU_DEBOUNCE)
+		return(false);
+	now = xTaskGetTickCount();
+	victim = &reader->recent[0];
+	for(i = 0; i < CTU_RECENT_CARDS; i++)
+	{
+		entry = &reader->recent[i];
+		if(entry->tick && entry->card_id == card_id)
+		{
+			repeat = now - entry->tick < CTU_DEBOUNCE;
+			entry->tick = now ? now : 1; /* 0 marks free entry */
+			return(repeat);
+		}
+		/* replace free or least recently seen entry */
+		if(!entry->tick || (victim->tick && now - entry->tick > now - victim->tick))
+			victim = entry;
+	}
+	victim->card_id = card_id;
+	victim->tick = now ? now : 1;
+	return(false);
+}
+
+/* powers reader and drives its trigger, both GPIOs are optional and not shared with other readers */
+static void ctu_gpio_init(board_reader_t reader)
+{
+	gpio_config_t conf = {
+			.pin_bit_mask = 0,
+			.mode = GPIO_MODE_OUTPUT,
+			.pull_up_en = GPIO_PULLUP_DISABLE,
+			.pull_down_en = GPIO_PULLDOWN_DISABLE,
+			.intr_type = GPIO_INTR_DISABLE,
+	};
+
+	/* levels are set before outputs are enabled */
+	if(reader->config.en_gpio >= 0)
+	{
+		gpio_set_level(reader->config.en_gpio, CONFIG_BOARD_READER_EN_ON_LEVEL);
+		conf.pin_bit_mask |= 1ULL << reader->config.en_gpio;
+	}
+	if(reader->config.trg_gpio >= 0)
+	{
+		gpio_set_level(reader->config.trg_gpio, CONFIG_BOARD_READER_TRG_LEVEL);
+		conf.pin_bit_mask |= 1ULL << reader->config.trg_gpio;
+	}
+	if(conf.pin_bit_mask)
+		ESP_ERROR_CHECK(gpio_config(&conf));
+}
+
+#ifdef CONFIG_BOARD_READER_POLL
+/* sends select command when due, handles missing response, returns ticks until next poll event */
+static TickType_t ctu_poll(board_reader_t reader)
+{
+	uint8_t cmd[NTXFR_MIN_FRAME_LEN];
+	size_t len;
+	TickType_t now;
+	TickType_t elapsed;
+
+	now = xTaskGetTickCount();
+	elapsed = now - reader->poll_tick;
+	if(reader->poll_pending)
+	{
+		if(elapsed < CTU_POLL_TIMEOUT)
+			return(CTU_POLL_TIMEOUT - elapsed);
+		/* no response */
+		reader->poll_pending = false;
+		reader->stats.poll_timeouts++;
+		reader->poll_misses++;
+		if(CONFIG_BOARD_READER_POLL_RESET && reader->poll_misses >= CONFIG_BOARD_READER_POLL_RESET)
+		{
+			ctu_power_cycle(reader);
+			reader->poll_misses = 0;
+			reader->poll_interval = pdMS_TO_TICKS(CONFIG_BOARD_READER_POLL_MIN);
+		}
+		reader->poll_tick = xTaskGetTickCount();
+		return(reader->poll_interval);
+	}
+	if(elapsed < reader->poll_interval)
+		return(reader->poll_interval - elapsed);
+	len = ntxfr_build(cmd, sizeof(cmd), reader->config.addr, CTU_CMD_SELECT, NULL, 0);
+	uart_write_bytes(reader->config.uart, cmd, len); /* no TX buffer, returns when sent */
+	reader->poll_pending = true;
+	reader->poll_tick = xTaskGetTickCount();
+	reader->stats.polls++;
+	return(CTU_POLL_TIMEOUT);
+}
+
+/* schedules next poll, soon after a card was seen, less often while the field is empty */
+static void ctu_poll_response(board_reader_t reader, bool card)
+{
+	if(!reader->poll_pending) /* unsolicited or late */
+		return;
+	reader->poll_pending = false;
+	reader->poll_misses = 0;
+	if(card)
+		reader->poll_interval = pdMS_TO_TICKS(CONFIG_BOARD_READER_POLL_MIN);
+	else if(reader->poll_interval < pdMS_TO_TICKS(CONFIG_BOARD_READER_POLL_MAX) / 2)
+		reader->poll_interval *= 2;
+	else
+		reader->poll_interval = pdMS_TO_TICKS(CONFIG_BOARD_READER_POLL_MAX);
+	reader->poll_tick = xTaskGetTickCount();
+}
+
+/* restarts unresponsive reader, blocks for power off and start up delays, other readers have their own power control */
+static void ctu_power_cycle(board_reader_t reader)
+{
+	if(reader->config.en_gpio < 0)
+		return;
+	ESP_LOGW(ctu_tag, "Reader %u not responding, power cycling", reader->config.id);
+	reader->stats.power_cycles++;
+	gpio_set_level(reader->config.en_gpio, !CONFIG_BOARD_READER_EN_ON_LEVEL);
+	vTaskDelay(pdMS_TO_TICKS(CONFIG_BOARD_READER_OFF_DELAY));
+	gpio_set_level(reader->config.en_gpio, CONFIG_BOARD_READER_EN_ON_LEVEL);
+	vTaskDelay(pdMS_TO_TICKS(CONFIG_BOARD_READER_ON_DELAY));
+	/* drop anything sent during start up */
+	ESP_ERROR_CHECK(uart_flush_input(reader->config.uart));
+	ntxfr_parser_reset(&reader->parser);
+}
+#endif
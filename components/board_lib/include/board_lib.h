@@ -3,6 +3,7 @@
 
 #include "esp_event.h"
 #include "driver/ledc.h"
+#include "driver/uart.h"
 
 #define BOARD_HW_INFO "Keybox Core prototype"
 
@@ -26,13 +27,46 @@ typedef enum {
 	BOARD_SERVO_MAX
 } board_servo_t;
 
+/* reader instance configuration */
+typedef struct {
+	uint8_t id;
+	uint8_t addr; /* NTX address for polling */
+	uart_port_t uart;
+	int tx_gpio;
+	int rx_gpio;
+	int en_gpio; /* power control for polling, -1 if not available */
+	int trg_gpio; /* trigger held at CONFIG_BOARD_READER_TRG_LEVEL, -1 if not available */
+} board_reader_config_t;
+
+/* reader statistics */
+typedef struct {
+	uint32_t frames;
+	uint32_t cards;
+	uint32_t incomplete_frames;
+	uint32_t resyncs;
+	uint32_t overflows;
+	uint32_t polls;
+	uint32_t poll_timeouts;
+	uint32_t power_cycles;
+	uint32_t suppressed; /* repeated cards not reported */
+} board_reader_stats_t;
+
+/* BOARD_EVENT_NEW_CARD data */
+typedef struct {
+	uint64_t card_id;
+	uint8_t reader_id;
+} board_card_event_t;
+
+typedef struct ctu_reader *board_reader_t;
+
 ESP_EVENT_DECLARE_BASE(BOARD_EVENT);
 
 void board_init(esp_event_loop_handle_t event_loop);
 void board_set_buzzer(bool state);
 void board_set_led(ledc_channel_t led_ch, uint32_t duty);
 void board_set_relay(bool state);
-void board_reader_start(esp_event_loop_handle_t event_loop, UBaseType_t task_priority);
+board_reader_t board_reader_start(const board_reader_config_t *config, esp_event_loop_handle_t event_loop, UBaseType_t task_priority);
+void board_reader_get_stats(board_reader_t reader, board_reader_stats_t *stats);
 void board_servo_set_angle(board_servo_t servo, int angle);
 
 #endif /* COMPONENTS_BOARD_LIB_INCLUDE_BOARD_LIB_H_ */
@@ -1,19 +1,46 @@
 #ifndef NTXFR_H
 #define NTXFR_H
 
-#include <glob.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
+/* frame is [addr][len][cmd/res][data...][crc_hi][crc_lo], len counts all bytes */
+#define NTXFR_MIN_FRAME_LEN 5
+#define NTXFR_MAX_FRAME_LEN 255
+
 typedef struct {
     const uint8_t *ptr;
     size_t len;
 } ntxfr_data_t;
 
+/* validated frame fields */
+typedef struct {
+    uint8_t addr;
+    uint8_t cmd;
+    ntxfr_data_t data;
+} ntxfr_frame_t;
+
+/* called for every received valid frame */
+typedef void (*ntxfr_frame_cb_t)(const ntxfr_frame_t *frame, void *arg);
+
+/* streaming frame parser state */
+typedef struct {
+    uint8_t buf[NTXFR_MAX_FRAME_LEN];
+    size_t pos;
+    uint32_t resyncs;
+} ntxfr_parser_t;
+
 uint8_t ntxfr_get_addr(const ntxfr_data_t payload);
 uint8_t ntxfr_get_cmd(const ntxfr_data_t payload);
 inline uint8_t ntxfr_get_res(const ntxfr_data_t payload){ return ntxfr_get_cmd(payload); };
 ntxfr_data_t ntxfr_get_data(const ntxfr_data_t payload);
 bool ntxfr_is_valid(const ntxfr_data_t payload);
+bool ntxfr_parse(const ntxfr_data_t payload, ntxfr_frame_t *frame);
+uint16_t ntxfr_crc16(const uint8_t *buf, size_t len);
+void ntxfr_parser_reset(ntxfr_parser_t *parser);
+void ntxfr_parser_feed(ntxfr_parser_t *parser, const uint8_t *data, size_t len, ntxfr_frame_cb_t cb, void *arg);
+size_t ntxfr_parser_flush(ntxfr_parser_t *parser, ntxfr_frame_cb_t cb, void *arg);
+size_t ntxfr_build(uint8_t *buf, size_t size, uint8_t addr, uint8_t cmd, const uint8_t *data, size_t data_len);
 
 #endif //NTXFR_H
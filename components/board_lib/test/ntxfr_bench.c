@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "ntxfr.h"
+#include "ntxfr_gen.h"
+
+#define BENCH_STREAM_LEN (4 * 1024 * 1024)
+#define BENCH_MAX_FRAMES (256 * 1024)
+
+static uint8_t bench_stream[BENCH_STREAM_LEN];
+static ntxfr_gen_frame_t bench_frames[BENCH_MAX_FRAMES];
+
+static void bench_count_cb(const ntxfr_frame_t *frame, void *arg)
+{
+	(*(size_t *)arg)++;
+	(void)frame;
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* parses the stream fed in chunks of given size, like UART reads of that size */
+static void bench_stream_run(const char *name, size_t stream_len, size_t count, size_t chunk, int rounds)
+{
+	ntxfr_parser_t parser;
+	size_t received = 0;
+	size_t pos;
+	size_t len;
+	double start;
+	double elapsed;
+	int round;
+
+	start = bench_now();
+	for (round = 0; round < rounds; round++)
+	{
+		ntxfr_parser_reset(&parser);
+		for (pos = 0; pos < stream_len; pos += len)
+		{
+			len = stream_len - pos < chunk ? stream_len - pos : chunk;
+			ntxfr_parser_feed(&parser, bench_stream + pos, len, bench_count_cb, &received);
+		}
+		ntxfr_parser_flush(&parser, bench_count_cb, &received);
+	}
+	elapsed = bench_now() - start;
+	printf("%-8s chunk %4zu: %8.2f MB/s %10.0f frames/s %7.1f ns/frame (%zu valid, %zu received)\n",
+		name, chunk, rounds * stream_len / elapsed / 1e6, rounds * count / elapsed,
+		elapsed * 1e9 / ((double)rounds * count), count, received / rounds);
+}
+
+int main(int argc, char **argv)
+{
+	static const uint8_t clean[NTXFR_GEN_KINDS] = {[NTXFR_GEN_VALID] = 1};
+	static const uint8_t noisy[NTXFR_GEN_KINDS] = {
+		[NTXFR_GEN_VALID] = 4,
+		[NTXFR_GEN_CORRUPTED] = 1,
+		[NTXFR_GEN_TRUNCATED] = 1,
+		[NTXFR_GEN_GARBAGE] = 1,
+	};
+	static const size_t chunks[] = {1, 16, 128, 1024};
+	int rounds = argc > 1 ? atoi(argv[1]) : 10;
+	ntxfr_gen_t gen;
+	size_t stream_len;
+	size_t count;
+	size_t i;
+
+	ntxfr_gen_init(&gen, 1, 0x01, 32);
+	stream_len = ntxfr_gen_stream(&gen, clean, bench_stream, sizeof(bench_stream), bench_frames, BENCH_MAX_FRAMES, &count);
+	for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++)
+		bench_stream_run("clean", stream_len, count, chunks[i], rounds);
+	ntxfr_gen_init(&gen, 1, 0x01, 32);
+	stream_len = ntxfr_gen_stream(&gen, noisy, bench_stream, sizeof(bench_stream), bench_frames, BENCH_MAX_FRAMES, &count);
+	for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++)
+		bench_stream_run("noisy", stream_len, count, chunks[i], rounds);
+	return 0;
+}
@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "ntxfr.h"
+#include "ntxfr_gen.h"
+
+#define BENCH_BUF_LEN (64 * 1024)
+
+static uint8_t bench_buf[BENCH_BUF_LEN];
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* CRC time per byte of the variant selected at build time, for frame sized and long buffers */
+int main(int argc, char **argv)
+{
+	static const size_t lens[] = {NTXFR_MIN_FRAME_LEN - 2, 16, 64, NTXFR_MAX_FRAME_LEN - 2, BENCH_BUF_LEN};
+	size_t total = argc > 1 ? (size_t)atoll(argv[1]) : 256 * 1024 * 1024;
+	volatile uint16_t sink = 0;
+	ntxfr_gen_t gen;
+	size_t done;
+	size_t pos;
+	size_t i;
+	double start;
+	double elapsed;
+
+	ntxfr_gen_init(&gen, 1, 0, 0);
+	for (i = 0; i < sizeof(bench_buf); i++)
+		bench_buf[i] = (uint8_t)ntxfr_gen_rand(&gen);
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++)
+	{
+		pos = 0;
+		start = bench_now();
+		for (done = 0; done < total; done += lens[i])
+		{
+			sink ^= ntxfr_crc16(bench_buf + pos, lens[i]);
+			pos += lens[i];
+			if (pos + lens[i] > sizeof(bench_buf))
+				pos = 0;
+		}
+		elapsed = bench_now() - start;
+		printf("%-10s %5zu B: %6.2f ns/byte %8.1f ns/call\n", NTXFR_CRC_NAME, lens[i],
+			elapsed * 1e9 / done, elapsed * 1e9 / (done / lens[i]));
+	}
+	(void)sink;
+	return 0;
+}
@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "ntxfr.h"
+#include "ntxfr_gen.h"
+
+#define TEST_BUFFERS 20000
+#define TEST_MAX_LEN 300
+
+/* reference CRC-16/CCITT (poly 0x1021, init 0), one bit at a time */
+static uint16_t test_crc_ref(const uint8_t *buf, size_t len)
+{
+	uint16_t crc = 0;
+	int bit;
+
+	while (len--)
+	{
+		crc ^= (uint16_t)(*buf++ << 8);
+		for (bit = 0; bit < 8; bit++)
+			crc = crc & 0x8000 ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+	}
+	return crc;
+}
+
+/* CRC variant selected at build time matches the reference on every length and alignment */
+int main(void)
+{
+	static const uint8_t check[] = "123456789";
+	uint8_t buf[TEST_MAX_LEN + 8];
+	ntxfr_gen_t gen;
+	size_t offset;
+	size_t len;
+	size_t i;
+	int n;
+	int failures = 0;
+
+	if (ntxfr_crc16(check, 9) != 0x31C3)
+	{
+		printf("FAIL %s: check value %04X\n", NTXFR_CRC_NAME, ntxfr_crc16(check, 9));
+		failures++;
+	}
+	ntxfr_gen_init(&gen, 1, 0, 0);
+	for (n = 0; n < TEST_BUFFERS; n++)
+	{
+		offset = ntxfr_gen_rand(&gen) % 8;
+		len = ntxfr_gen_rand(&gen) % (TEST_MAX_LEN + 1);
+		for (i = 0; i < len; i++)
+			buf[offset + i] = (uint8_t)ntxfr_gen_rand(&gen);
+		if (ntxfr_crc16(buf + offset, len) != test_crc_ref(buf + offset, len))
+		{
+			printf("FAIL %s: buffer %d, length %zu, offset %zu\n", NTXFR_CRC_NAME, n, len, offset);
+			failures++;
+		}
+	}
+	if (failures)
+		return 1;
+	printf("%s: %d buffers match reference\n", NTXFR_CRC_NAME, TEST_BUFFERS);
+	return 0;
+}
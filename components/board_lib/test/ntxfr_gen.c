@@ -0,0 +1,106 @@
+#include "ntxfr_gen.h"
+
+#include <string.h>
+
+/* xorshift32, same sequence on every host */
+uint32_t ntxfr_gen_rand(ntxfr_gen_t *gen)
+{
+	uint32_t x = gen->state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	gen->state = x;
+	return x;
+}
+
+void ntxfr_gen_init(ntxfr_gen_t *gen, uint32_t seed, uint8_t addr, size_t max_data)
+{
+	gen->state = seed ? seed : 1;
+	gen->addr = addr;
+	gen->max_data = max_data > NTXFR_MAX_FRAME_LEN - NTXFR_MIN_FRAME_LEN ? NTXFR_MAX_FRAME_LEN - NTXFR_MIN_FRAME_LEN : max_data;
+}
+
+/*
+writes one stream piece of the given kind, returns its length or 0 if it does not fit
+frame is filled for valid pieces only and may be NULL
+*/
+size_t ntxfr_gen_piece(ntxfr_gen_t *gen, ntxfr_gen_kind_t kind, uint8_t *buf, size_t size, ntxfr_gen_frame_t *frame)
+{
+	uint8_t data[NTXFR_MAX_FRAME_LEN];
+	size_t data_len = ntxfr_gen_rand(gen) % (gen->max_data + 1);
+	size_t len;
+	size_t i;
+	uint8_t cmd = (uint8_t)ntxfr_gen_rand(gen);
+
+	if (kind == NTXFR_GEN_GARBAGE)
+	{
+		len = 1 + ntxfr_gen_rand(gen) % (gen->max_data + NTXFR_MIN_FRAME_LEN);
+		if (len > size)
+			return 0;
+		for (i = 0; i < len; i++)
+			buf[i] = (uint8_t)ntxfr_gen_rand(gen);
+		return len;
+	}
+	for (i = 0; i < data_len; i++)
+		data[i] = (uint8_t)ntxfr_gen_rand(gen);
+	len = ntxfr_build(buf, size, gen->addr, cmd, data, data_len);
+	if (!len)
+		return 0;
+	switch (kind)
+	{
+	case NTXFR_GEN_VALID:
+		if (frame)
+		{
+			frame->addr = gen->addr;
+			frame->cmd = cmd;
+			memcpy(frame->data, data, data_len);
+			frame->len = data_len;
+		}
+		break;
+	case NTXFR_GEN_CORRUPTED:
+		i = ntxfr_gen_rand(gen) % (8 * len);
+		buf[i / 8] ^= (uint8_t)(1 << (i % 8));
+		break;
+	case NTXFR_GEN_TRUNCATED:
+		len = 1 + ntxfr_gen_rand(gen) % (len - 1);
+		break;
+	default:
+		break;
+	}
+	return len;
+}
+
+/*
+concatenates pieces picked by weight until buf is full, returns stream length
+valid frames are stored in order in frames, their number in count
+*/
+size_t ntxfr_gen_stream(ntxfr_gen_t *gen, const uint8_t weights[NTXFR_GEN_KINDS], uint8_t *buf, size_t size, ntxfr_gen_frame_t *frames, size_t max_frames, size_t *count)
+{
+	uint32_t total = 0;
+	uint32_t pick;
+	size_t pos = 0;
+	size_t len;
+	int kind;
+
+	*count = 0;
+	for (kind = 0; kind < NTXFR_GEN_KINDS; kind++)
+		total += weights[kind];
+	if (!total)
+		return 0;
+	while (true)
+	{
+		pick = ntxfr_gen_rand(gen) % total;
+		for (kind = 0; pick >= weights[kind]; kind++)
+			pick -= weights[kind];
+		if (kind == NTXFR_GEN_VALID && *count == max_frames)
+			break;
+		len = ntxfr_gen_piece(gen, kind, buf + pos, size - pos, kind == NTXFR_GEN_VALID ? &frames[*count] : NULL);
+		if (!len)
+			break;
+		if (kind == NTXFR_GEN_VALID)
+			frames[(*count)++].offset = pos;
+		pos += len;
+	}
+	return pos;
+}
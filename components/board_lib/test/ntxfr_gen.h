@@ -0,0 +1,38 @@
+#ifndef NTXFR_GEN_H
+#define NTXFR_GEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ntxfr.h"
+
+/* kinds of generated stream pieces */
+typedef enum {
+    NTXFR_GEN_VALID,
+    NTXFR_GEN_CORRUPTED, /* valid frame with one bit flipped */
+    NTXFR_GEN_TRUNCATED, /* valid frame cut short */
+    NTXFR_GEN_GARBAGE, /* random bytes */
+    NTXFR_GEN_KINDS
+} ntxfr_gen_kind_t;
+
+/* deterministic generator state */
+typedef struct {
+    uint32_t state;
+    uint8_t addr;
+    size_t max_data; /* longest frame data generated */
+} ntxfr_gen_t;
+
+/* expected frame, valid pieces of a stream in order */
+typedef struct {
+    uint8_t addr;
+    uint8_t cmd;
+    uint8_t data[NTXFR_MAX_FRAME_LEN];
+    size_t len;
+    size_t offset; /* frame start in the stream */
+} ntxfr_gen_frame_t;
+
+void ntxfr_gen_init(ntxfr_gen_t *gen, uint32_t seed, uint8_t addr, size_t max_data);
+uint32_t ntxfr_gen_rand(ntxfr_gen_t *gen);
+size_t ntxfr_gen_piece(ntxfr_gen_t *gen, ntxfr_gen_kind_t kind, uint8_t *buf, size_t size, ntxfr_gen_frame_t *frame);
+size_t ntxfr_gen_stream(ntxfr_gen_t *gen, const uint8_t weights[NTXFR_GEN_KINDS], uint8_t *buf, size_t size, ntxfr_gen_frame_t *frames, size_t max_frames, size_t *count);
+
+#endif //NTXFR_GEN_H
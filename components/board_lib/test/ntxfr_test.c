@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "ntxfr.h"
+#include "ntxfr_gen.h"
+
+#define TEST_STREAM_LEN (256 * 1024)
+#define TEST_MAX_FRAMES 4096
+#define TEST_SEEDS 16
+
+#define TEST_MAX_SPURIOUS 256
+
+/* frame of the stream, start is offset in the stream */
+typedef struct {
+	size_t start;
+	size_t len;
+} test_span_t;
+
+typedef struct {
+	const ntxfr_gen_frame_t *expected;
+	size_t count;
+	size_t next;
+	size_t matched;
+	const ntxfr_parser_t *parser;
+	size_t fed;
+	test_span_t spurious[TEST_MAX_SPURIOUS];
+	size_t spurious_count;
+} test_match_t;
+
+static uint8_t test_buf[TEST_STREAM_LEN];
+static ntxfr_gen_frame_t test_frames[TEST_MAX_FRAMES];
+static bool test_recovered[TEST_MAX_FRAMES];
+static int test_failures;
+
+#define TEST_CHECK(cond, ...) do { \
+	if (!(cond)) \
+	{ \
+		printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		test_failures++; \
+	} \
+} while (0)
+
+/*
+frame is at the start of the parser buffer which ends at the last fed byte,
+frames found in the noise are recorded as spurious with their stream span
+*/
+static void test_match_cb(const ntxfr_frame_t *frame, void *arg)
+{
+	test_match_t *match = arg;
+	const ntxfr_gen_frame_t *want;
+	size_t start = match->fed - match->parser->pos;
+
+	while (match->next < match->count && match->expected[match->next].offset < start)
+		match->next++;
+	if (match->next < match->count)
+	{
+		want = &match->expected[match->next];
+		if (want->offset == start && frame->addr == want->addr && frame->cmd == want->cmd &&
+			frame->data.len == want->len && !memcmp(frame->data.ptr, want->data, want->len))
+		{
+			test_recovered[match->next++] = true;
+			match->matched++;
+			return;
+		}
+	}
+	if (match->spurious_count < TEST_MAX_SPURIOUS)
+	{
+		match->spurious[match->spurious_count].start = start;
+		match->spurious[match->spurious_count].len = frame->data.len + NTXFR_MIN_FRAME_LEN;
+	}
+	match->spurious_count++;
+}
+
+/* lost frame is fine only if a spurious frame found in the noise overlaps it */
+static bool test_swallowed(const test_match_t *match, const ntxfr_gen_frame_t *frame)
+{
+	size_t end = frame->offset + frame->len + NTXFR_MIN_FRAME_LEN;
+	size_t i;
+
+	for (i = 0; i < match->spurious_count && i < TEST_MAX_SPURIOUS; i++)
+	{
+		if (match->spurious[i].start < end && frame->offset < match->spurious[i].start + match->spurious[i].len)
+			return true;
+	}
+	return false;
+}
+
+static void test_count_cb(const ntxfr_frame_t *frame, void *arg)
+{
+	(*(size_t *)arg)++;
+	(void)frame;
+}
+
+static void test_crc(void)
+{
+	static const uint8_t check[] = "123456789";
+
+	TEST_CHECK(ntxfr_crc16(check, 9) == 0x31C3, "crc16 check value %04X", ntxfr_crc16(check, 9));
+	TEST_CHECK(ntxfr_crc16(check, 0) == 0, "crc16 of empty buffer");
+}
+
+static void test_build_parse(void)
+{
+	uint8_t data[NTXFR_MAX_FRAME_LEN];
+	uint8_t buf[NTXFR_MAX_FRAME_LEN];
+	ntxfr_data_t payload;
+	ntxfr_frame_t frame;
+	size_t data_len;
+	size_t len;
+
+	for (data_len = 0; data_len <= NTXFR_MAX_FRAME_LEN - NTXFR_MIN_FRAME_LEN; data_len++)
+	{
+		memset(data, (int)data_len, data_len);
+		len = ntxfr_build(buf, sizeof(buf), 0x12, 0x34, data, data_len);
+		TEST_CHECK(len == data_len + NTXFR_MIN_FRAME_LEN, "build length %zu", data_len);
+		payload.ptr = buf;
+		payload.len = len;
+		TEST_CHECK(ntxfr_parse(payload, &frame), "parse length %zu", data_len);
+		TEST_CHECK(frame.addr == 0x12 && frame.cmd == 0x34 && frame.data.len == data_len, "fields length %zu", data_len);
+		buf[len - 1] ^= 1;
+		TEST_CHECK(!ntxfr_parse(payload, &frame), "corrupted CRC accepted, length %zu", data_len);
+	}
+	TEST_CHECK(!ntxfr_build(buf, sizeof(buf), 0, 0, data, NTXFR_MAX_FRAME_LEN - NTXFR_MIN_FRAME_LEN + 1), "oversized frame built");
+	TEST_CHECK(!ntxfr_build(buf, NTXFR_MIN_FRAME_LEN - 1, 0, 0, NULL, 0), "frame built into short buffer");
+}
+
+/* clean stream comes out whole whatever the read chunking */
+static void test_chunked(void)
+{
+	static const uint8_t clean[NTXFR_GEN_KINDS] = {[NTXFR_GEN_VALID] = 1};
+	ntxfr_parser_t parser;
+	ntxfr_gen_t gen;
+	size_t stream_len;
+	size_t count;
+	size_t received;
+	size_t pos;
+	size_t chunk;
+	uint32_t seed;
+
+	for (seed = 1; seed <= TEST_SEEDS; seed++)
+	{
+		ntxfr_gen_init(&gen, seed, (uint8_t)seed, NTXFR_MAX_FRAME_LEN);
+		stream_len = ntxfr_gen_stream(&gen, clean, test_buf, sizeof(test_buf), test_frames, TEST_MAX_FRAMES, &count);
+		received = 0;
+		ntxfr_parser_reset(&parser);
+		parser.resyncs = 0;
+		for (pos = 0; pos < stream_len; pos += chunk)
+		{
+			chunk = 1 + ntxfr_gen_rand(&gen) % 300;
+			if (chunk > stream_len - pos)
+				chunk = stream_len - pos;
+			ntxfr_parser_feed(&parser, test_buf + pos, chunk, test_count_cb, &received);
+		}
+		TEST_CHECK(received == count, "seed %u: %zu of %zu frames received", seed, received, count);
+		TEST_CHECK(parser.resyncs == 0 && parser.pos == 0, "seed %u: %u resyncs, %zu bytes left", seed, parser.resyncs, parser.pos);
+	}
+}
+
+/*
+every valid frame of a noisy stream is recovered, except frames overlapped by
+a frame that noise happened to form with a matching CRC
+*/
+static void test_noisy(void)
+{
+	static const uint8_t noisy[NTXFR_GEN_KINDS] = {
+		[NTXFR_GEN_VALID] = 4,
+		[NTXFR_GEN_CORRUPTED] = 1,
+		[NTXFR_GEN_TRUNCATED] = 1,
+		[NTXFR_GEN_GARBAGE] = 1,
+	};
+	static test_match_t match;
+	ntxfr_parser_t parser;
+	ntxfr_gen_t gen;
+	size_t stream_len;
+	size_t count;
+	size_t lost;
+	size_t i;
+	uint32_t seed;
+
+	for (seed = 1; seed <= TEST_SEEDS; seed++)
+	{
+		ntxfr_gen_init(&gen, seed, (uint8_t)seed, 64);
+		stream_len = ntxfr_gen_stream(&gen, noisy, test_buf, sizeof(test_buf), test_frames, TEST_MAX_FRAMES, &count);
+		memset(&match, 0, sizeof(match));
+		memset(test_recovered, 0, sizeof(test_recovered));
+		match.expected = test_frames;
+		match.count = count;
+		match.parser = &parser;
+		ntxfr_parser_reset(&parser);
+		parser.resyncs = 0;
+		for (match.fed = 0; match.fed < stream_len; )
+		{
+			match.fed++;
+			ntxfr_parser_feed(&parser, test_buf + match.fed - 1, 1, test_match_cb, &match);
+		}
+		ntxfr_parser_flush(&parser, test_match_cb, &match);
+		TEST_CHECK(parser.pos == 0, "seed %u: parser not empty after flush", seed);
+		TEST_CHECK(match.spurious_count <= TEST_MAX_SPURIOUS, "seed %u: %zu spurious frames", seed, match.spurious_count);
+		lost = 0;
+		for (i = 0; i < count; i++)
+		{
+			if (test_recovered[i])
+				continue;
+			lost++;
+			TEST_CHECK(test_swallowed(&match, &test_frames[i]), "seed %u: frame %zu at %zu lost", seed, i, test_frames[i].offset);
+		}
+		printf("seed %2u: %zu frames, %zu lost to %zu spurious, %u resyncs\n", seed, count, lost, match.spurious_count, parser.resyncs);
+	}
+}
+
+/* random bytes never crash the parser or leave it stuck */
+static void test_fuzz(void)
+{
+	ntxfr_parser_t parser;
+	ntxfr_gen_t gen;
+	size_t received = 0;
+	size_t pos;
+	uint8_t frame[NTXFR_MAX_FRAME_LEN];
+	size_t len;
+
+	ntxfr_gen_init(&gen, 0xC0FFEE, 0, 0);
+	for (pos = 0; pos < sizeof(test_buf); pos++)
+		test_buf[pos] = (uint8_t)ntxfr_gen_rand(&gen);
+	ntxfr_parser_reset(&parser);
+	ntxfr_parser_feed(&parser, test_buf, sizeof(test_buf), test_count_cb, &received);
+	ntxfr_parser_flush(&parser, test_count_cb, &received);
+	TEST_CHECK(parser.pos == 0, "parser not empty after flush");
+
+	/* parser still picks up a clean frame after the noise */
+	len = ntxfr_build(frame, sizeof(frame), 1, 2, NULL, 0);
+	received = 0;
+	ntxfr_parser_feed(&parser, frame, len, test_count_cb, &received);
+	TEST_CHECK(received == 1, "clean frame after noise, %zu received", received);
+}
+
+int main(void)
+{
+	test_crc();
+	test_build_parse();
+	test_chunked();
+	test_noisy();
+	test_fuzz();
+	if (test_failures)
+	{
+		printf("%d checks failed\n", test_failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
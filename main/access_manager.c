@@ -1,18 +1,38 @@
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/timers.h"
 #include "access_manager.h"
 #include "esp_log.h"
 #include "nvs.h"
 
-#define ACL_LEN 100
+/* number of recent lookups remembered */
+#define ACCESS_CACHE_LEN 8
+/* acl lookup statistics are logged this often */
+#define ACCESS_STATS_PERIOD pdMS_TO_TICKS(60 * 60 * 1000)
+
+/* lookup result valid while acl store revision is unchanged */
+typedef struct {
+    uint64_t card_id;
+    uint32_t revision;
+    uint8_t privilege_to_slots;
+    bool found;
+    bool valid;
+} access_cache_entry_t;
 
 static const char *access_tag = "access";
 static nvs_handle_t access_nvs_handle;
 esp_err_t result;
 
-static size_t acl_size = sizeof(ac_t) * ACL_LEN;
-ac_t acl[ACL_LEN];
-static uint8_t acl_counter;
+/* used only by the application event loop task */
+static access_cache_entry_t access_cache[ACCESS_CACHE_LEN];
+static size_t access_cache_next;
+/* logs acl lookup statistics */
+static TimerHandle_t access_stats_timer;
+
+static void access_import_legacy_acl(void);
+static void access_stats_cb(TimerHandle_t timer);
 
-void access_init()
+void access_init(const esp_partition_t *partition)
 {
 	result = nvs_open(access_tag, NVS_READWRITE, &access_nvs_handle);
 	if(result != ESP_OK)
@@ -22,117 +42,186 @@ void access_init()
 	}
     ESP_LOGI(access_tag, "Successfuly initialized Access to NVS");
 
-    /* load acl from NVS */ 
-    access_get_acl_from_nvs();
+    /* map acl stored in its partition, without partition the legacy blob stays in use */
+    result = acl_store_init(partition, access_nvs_handle);
+    if(result != ESP_OK)
+    {
+        ESP_LOGE(access_tag, "Error with acl store initialization %d", result);
+        return;
+    }
+    if(partition)
+        access_import_legacy_acl();
+    ESP_LOGI(access_tag, "acl loaded, %u cards", acl_store_count());
+    access_stats_timer = xTimerCreate("acl_stats", ACCESS_STATS_PERIOD, pdTRUE, NULL, access_stats_cb);
+    if(access_stats_timer)
+        xTimerStart(access_stats_timer, 0);
 }
 
 bool access_find_card_id_in_nvs(uint64_t card_id, uint8_t *privilege_to_slots)
 {
-    ESP_LOGI(access_tag, "Checking card %llu in nvs", card_id);
-    int8_t i, j;
-    for (i = 0; i < acl_counter; i++)
+    ESP_LOGI(access_tag, "Checking card %llu in acl", card_id);
+    if (!privilege_to_slots)
+    {
+        ESP_LOGE(access_tag, "Could not get privilege to slots");
+        return false;
+    }
+
+    /* acl updates change the revision, which drops cached results */
+    uint32_t revision = acl_store_revision();
+    access_cache_entry_t *entry = NULL;
+    size_t i;
+    for (i = 0; i < ACCESS_CACHE_LEN; i++)
     {
-        uint64_t nvs_card_id = 0;
-        for (j = 4; j >= 0; j--)
+        if (access_cache[i].valid && access_cache[i].card_id == card_id && access_cache[i].revision == revision)
         {
-            /* compress each byte of the known card id in nvs */
-            nvs_card_id = (nvs_card_id << 8) | acl[i].data[j]; 
+            entry = &access_cache[i];
+            ESP_LOGD(access_tag, "Cached result for card %llu", card_id);
+            break;
         }
-        
-        if (nvs_card_id == card_id)
-        {
-            ESP_LOGI(access_tag, "Found card %llu in nvs", card_id);
-            if (!privilege_to_slots)
-            {
-                ESP_LOGE(access_tag, "Could not get privilege to slots");
-                return false;
-            }
+    }
 
-            *privilege_to_slots = acl[i].data[SLOTS_BYTE];
-            return true;
-        }
+    if (!entry)
+    {
+        entry = &access_cache[access_cache_next];
+        access_cache_next = (access_cache_next + 1) % ACCESS_CACHE_LEN;
+        entry->card_id = card_id;
+        entry->revision = revision;
+        entry->found = acl_store_find(card_id, &entry->privilege_to_slots);
+        entry->valid = true;
+    }
+
+    if (entry->found)
+    {
+        ESP_LOGI(access_tag, "Found card %llu in acl", card_id);
+        *privilege_to_slots = entry->privilege_to_slots;
+        return true;
     }
 
-    ESP_LOGI(access_tag, "Could not find card in nvs");
+    ESP_LOGI(access_tag, "Could not find card in acl");
     return false;
 }
 
 void access_save_card_id_in_ram(uint64_t card_id, uint8_t privilege_to_slots)
 {
-    ESP_LOGI(access_tag, "Saving card %llu in ram", card_id);
-    int8_t i;
-    for (i = 0; i < 5; i++) 
-    {
-        /* extract each byte of the card id */
-        acl[acl_counter].data[i] = (uint8_t)(card_id >> (8 * i)); 
-    }
-
-    if (acl_counter < ACL_LEN)
-    {
-        acl[acl_counter].data[SLOTS_BYTE] = privilege_to_slots;
-        acl_counter++;
-    }
+    ESP_LOGD(access_tag, "Saving card %llu", card_id);
+    acl_store_add(card_id, privilege_to_slots);
 }
 
 esp_err_t access_get_acl_from_nvs(void)
 {
-    ESP_LOGI(access_tag, "Fetching acl from nvs");
-    result = nvs_get_u8(access_nvs_handle, "acl_counter", &acl_counter);
-    if(result != ESP_OK)
-    {
-		ESP_LOGE(access_tag, "Error with acl counter initialization");
-		return result;
-	}
-
-    result = nvs_get_blob(access_nvs_handle, "acl", &acl, &acl_size);
+    ESP_LOGI(access_tag, "Fetching acl state from nvs");
+    result = acl_store_load();
     if(result != ESP_OK)
     {
 		ESP_LOGE(access_tag, "Error with acl initialization");
 		return result;
 	}
-    
-    size_t i;
-    for (i = 0; i < acl_counter; i++)
-    {
-        ESP_LOGD(access_tag, "acl id: %d, card ID: %x, %x, %x, %x, %x, slots: %x", i, acl[i].data[CARD_ID_BYTE_0], acl[i].data[CARD_ID_BYTE_1], acl[i].data[CARD_ID_BYTE_2], acl[i].data[CARD_ID_BYTE_3], acl[i].data[CARD_ID_BYTE_4], acl[i].data[SLOTS_BYTE]);
-    } 
 
+    ESP_LOGD(access_tag, "acl size: %u", acl_store_count());
     return result;
 }
 
-esp_err_t access_set_acl_in_nvs(void)
+esp_err_t access_set_acl_in_nvs(uint32_t generation)
 {
-    ESP_LOGI(access_tag, "Saving acl in NVS");
-    result = nvs_set_u8(access_nvs_handle, "acl_counter", acl_counter);
-    if(result != ESP_OK)
-    {
-		ESP_LOGE(access_tag, "Error with acl counter initialization");
-		return result;
-	}
-
-    result = nvs_set_blob(access_nvs_handle, "acl", &acl, acl_size);
+    ESP_LOGI(access_tag, "Saving acl generation %u", generation);
+    result = acl_store_commit(generation);
     if(result != ESP_OK)
     {
-        ESP_LOGE(access_tag, "Error while setting acl in nvs");
+        ESP_LOGE(access_tag, "Error while saving acl");
         return result;
     }
-    nvs_commit(access_nvs_handle);
     return result;
 }
 
+uint32_t access_get_acl_generation(void)
+{
+    return acl_store_generation();
+}
+
+/* adds card or changes its slots in place, saved by access_set_acl_delta_in_nvs() */
+esp_err_t access_update_card(uint64_t card_id, uint8_t privilege_to_slots)
+{
+    ESP_LOGD(access_tag, "Updating card %llu, slots: %x", card_id, privilege_to_slots);
+    return acl_store_set(card_id, privilege_to_slots);
+}
+
+/* removes card in place, saved by access_set_acl_delta_in_nvs() */
+esp_err_t access_remove_card(uint64_t card_id)
+{
+    ESP_LOGD(access_tag, "Removing card %llu", card_id);
+    return acl_store_remove(card_id);
+}
+
+esp_err_t access_set_acl_delta_in_nvs(uint32_t generation)
+{
+    ESP_LOGI(access_tag, "Saving acl changes, generation %u", generation);
+    return acl_store_save_delta(generation);
+}
+
 void access_fill_with_zeros_acl(void)
 {
-    size_t i;
-    for (i = 0; i < ACL_LEN; i++)
+    /* start a new acl, the current one stays in use until saved */
+    result = acl_store_begin();
+    if(result != ESP_OK)
     {
-        acl[i].data[CARD_ID_BYTE_0] = 0x00;
-        acl[i].data[CARD_ID_BYTE_1] = 0x00;
-        acl[i].data[CARD_ID_BYTE_2] = 0x00;
-        acl[i].data[CARD_ID_BYTE_3] = 0x00;
-        acl[i].data[CARD_ID_BYTE_4] = 0x00;
-        acl[i].data[SLOTS_BYTE] = 0x00;
+        ESP_LOGE(access_tag, "Error starting new acl");
     }
-    
-    acl_counter = 0;
     return;
-}
\ No newline at end of file
+}
+
+/* drops acl started by access_fill_with_zeros_acl() */
+void access_discard_acl(void)
+{
+    acl_store_abort();
+}
+
+/* moves acl saved as a NVS blob by older firmware to the acl store */
+static void access_import_legacy_acl(void)
+{
+    uint8_t acl_counter;
+    size_t acl_size = sizeof(ac_t) * ACL_STORE_LEGACY_LEN;
+    ac_t *acl;
+    size_t i;
+    int8_t j;
+
+    if(nvs_get_u8(access_nvs_handle, "acl_counter", &acl_counter) != ESP_OK)
+        return;
+    acl = malloc(acl_size);
+    if(!acl)
+        return;
+    if(nvs_get_blob(access_nvs_handle, "acl", acl, &acl_size) == ESP_OK && acl_store_begin() == ESP_OK)
+    {
+        ESP_LOGI(access_tag, "Importing %d cards from nvs", acl_counter);
+        for (i = 0; i < acl_counter && i < ACL_STORE_LEGACY_LEN; i++)
+        {
+            uint64_t card_id = 0;
+            for (j = CARD_ID_BYTE_4; j >= CARD_ID_BYTE_0; j--)
+            {
+                card_id = (card_id << 8) | acl[i].data[j];
+            }
+            acl_store_add(card_id, acl[i].data[SLOTS_BYTE]);
+        }
+        if(acl_store_commit(0) == ESP_OK)
+        {
+            nvs_erase_key(access_nvs_handle, "acl_counter");
+            nvs_erase_key(access_nvs_handle, "acl");
+            nvs_commit(access_nvs_handle);
+        }
+    }
+    free(acl);
+}
+
+/* logs Bloom filter false positive rate, only if the bank was searched since last time */
+static void access_stats_cb(TimerHandle_t timer)
+{
+    static uint32_t bank_lookups;
+    acl_store_stats_t stats;
+    (void)timer;
+
+    acl_store_get_stats(&stats);
+    if(stats.bank_lookups == bank_lookups)
+        return;
+    bank_lookups = stats.bank_lookups;
+    ESP_LOGI(access_tag, "acl bank lookups %u, filter rejects %u, false positives %u, false positive rate %.4f, estimated %.4f",
+            stats.bank_lookups, stats.filter_rejects, stats.filter_false_positives, stats.filter_fp_rate, stats.filter_fp_estimate);
+}
@@ -3,26 +3,20 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include "esp_partition.h"
 #include "nvs.h"
+#include "acl_store.h"
 
-typedef union {
-    uint8_t data[6];
-} ac_t;
-
-typedef enum {
-    CARD_ID_BYTE_0,
-    CARD_ID_BYTE_1,
-    CARD_ID_BYTE_2,
-    CARD_ID_BYTE_3,
-    CARD_ID_BYTE_4,
-    SLOTS_BYTE
-} acl_byte_map;
-
-void access_init();
+void access_init(const esp_partition_t *partition);
 bool access_find_card_id_in_nvs(uint64_t card_id, uint8_t *privilege_to_slots);
 void access_save_card_id_in_ram(uint64_t card_id, uint8_t privilege_to_slots);
 void access_fill_with_zeros_acl(void);
+void access_discard_acl(void);
 esp_err_t access_get_acl_from_nvs(void);
-esp_err_t access_set_acl_in_nvs(void);
+esp_err_t access_set_acl_in_nvs(uint32_t generation);
+uint32_t access_get_acl_generation(void);
+esp_err_t access_update_card(uint64_t card_id, uint8_t privilege_to_slots);
+esp_err_t access_remove_card(uint64_t card_id);
+esp_err_t access_set_acl_delta_in_nvs(uint32_t generation);
 
-#endif //KEY_SCANNER_ESP32_ACCESS_MANAGER_H
\ No newline at end of file
+#endif //KEY_SCANNER_ESP32_ACCESS_MANAGER_H
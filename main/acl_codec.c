@@ -0,0 +1,419 @@
+#include <ctype.h>
+#include <string.h>
+#include "acl_codec.h"
+
+/*
+
+ACL DOCUMENT FORMATS
+
+version 1
+["hexid:slots", ...]
+{"gen": generation, "acl": ["hexid:slots", ...]}
+
+version 2
+{"v": 2, "gen": generation, "bin": "base64"}
+
+The binary acl starts with a flags byte followed by records. A record is the
+5 byte little endian card id and the slots byte, same as ac_t. With the delta
+flag set card ids must be sorted, each record is then the LEB128 varint
+difference from the previous card id followed by the slots byte. Differences
+after the first record are never zero and card ids fit 5 bytes.
+
+The document is tokenized in place in a single pass, entries are passed to the
+callback as they are read. Nothing is allocated, unknown object members and
+non string array items are skipped.
+
+*/
+
+/* longest card id accepted in an entry, card ids are stored in 5 bytes */
+#define ACL_CODEC_MAX_ID_DIGITS 10
+#define ACL_CODEC_MAX_SLOTS_DIGITS 2
+/* largest card id, stored in 5 bytes */
+#define ACL_CODEC_MAX_CARD_ID 0xFFFFFFFFFFull
+
+typedef struct
+{
+	const char *pos;
+	const char *end;
+} acl_codec_scan_t;
+
+/* binary acl decoder state */
+typedef struct
+{
+	bool has_flags;
+	uint8_t flags;
+	uint8_t record[6];
+	size_t record_len;
+	uint64_t card_id;
+	uint64_t delta;
+	uint8_t shift;
+	bool has_delta;
+	bool has_card; /* a record was decoded, later differences must not be zero */
+} acl_codec_bin_t;
+
+static int acl_codec_base64_digit(char c)
+{
+	if(c >= 'A' && c <= 'Z')
+		return(c - 'A');
+	if(c >= 'a' && c <= 'z')
+		return(c - 'a' + 26);
+	if(c >= '0' && c <= '9')
+		return(c - '0' + 52);
+	if(c == '+' || c == '-')
+		return(62);
+	if(c == '/' || c == '_')
+		return(63);
+	return(-1);
+}
+
+static int acl_codec_hex_digit(char c)
+{
+	if(c >= '0' && c <= '9')
+		return(c - '0');
+	if(c >= 'a' && c <= 'f')
+		return(c - 'a' + 10);
+	if(c >= 'A' && c <= 'F')
+		return(c - 'A' + 10);
+	return(-1);
+}
+
+static void acl_codec_skip_ws(acl_codec_scan_t *scan)
+{
+	while(scan->pos < scan->end && (*scan->pos == ' ' || *scan->pos == '\t' || *scan->pos == '\n' || *scan->pos == '\r'))
+		scan->pos++;
+}
+
+/* skips a string, returns its raw content without quotes */
+static bool acl_codec_scan_string(acl_codec_scan_t *scan, const char **str, size_t *len)
+{
+	const char *start;
+
+	if(scan->pos >= scan->end || *scan->pos != '"')
+		return(false);
+	start = ++scan->pos;
+	while(scan->pos < scan->end && *scan->pos != '"')
+	{
+		if(*scan->pos == '\\') /* escaped character */
+			scan->pos++;
+		scan->pos++;
+	}
+	if(scan->pos >= scan->end)
+		return(false);
+	if(str)
+		*str = start;
+	if(len)
+		*len = scan->pos - start;
+	scan->pos++;
+	return(true);
+}
+
+static bool acl_codec_scan_uint(acl_codec_scan_t *scan, uint32_t *value)
+{
+	uint64_t result = 0;
+	const char *start = scan->pos;
+
+	while(scan->pos < scan->end && *scan->pos >= '0' && *scan->pos <= '9')
+	{
+		result = result * 10 + (*scan->pos - '0');
+		if(result > UINT32_MAX)
+			return(false);
+		scan->pos++;
+	}
+	*value = result;
+	return(scan->pos != start);
+}
+
+/* skips any value, nested containers included */
+static bool acl_codec_skip_value(acl_codec_scan_t *scan)
+{
+	size_t depth = 0;
+	const char *start;
+
+	do
+	{
+		acl_codec_skip_ws(scan);
+		if(scan->pos >= scan->end)
+			return(false);
+		switch(*scan->pos)
+		{
+		case '"':
+			if(!acl_codec_scan_string(scan, NULL, NULL))
+				return(false);
+			break;
+		case '[':
+		case '{':
+			depth++;
+			scan->pos++;
+			break;
+		case ']':
+		case '}':
+			if(!depth)
+				return(false);
+			depth--;
+			scan->pos++;
+			break;
+		case ',':
+		case ':':
+			if(!depth)
+				return(false);
+			scan->pos++;
+			break;
+		default: /* number or literal */
+			start = scan->pos;
+			while(scan->pos < scan->end && (isalnum((unsigned char)*scan->pos) || *scan->pos == '+' || *scan->pos == '-' || *scan->pos == '.'))
+				scan->pos++;
+			if(scan->pos == start)
+				return(false);
+		}
+	} while(depth);
+	return(true);
+}
+
+static bool acl_codec_scan_acl(acl_codec_scan_t *scan, acl_codec_doc_t *doc, acl_codec_entry_cb_t cb, void *arg)
+{
+	const char *str;
+	size_t len;
+	uint64_t card_id;
+	uint8_t slots;
+
+	if(scan->pos >= scan->end || *scan->pos != '[')
+		return(false);
+	scan->pos++;
+	acl_codec_skip_ws(scan);
+	if(scan->pos < scan->end && *scan->pos == ']')
+	{
+		scan->pos++;
+		return(true);
+	}
+	while(true)
+	{
+		acl_codec_skip_ws(scan);
+		if(scan->pos < scan->end && *scan->pos == '"')
+		{
+			if(!acl_codec_scan_string(scan, &str, &len))
+				return(false);
+			if(acl_codec_parse_entry(str, len, &card_id, &slots))
+			{
+				doc->entries++;
+				if(cb && !cb(card_id, slots, arg))
+					return(false);
+			}
+			else
+			{
+				doc->skipped++;
+			}
+		}
+		else if(!acl_codec_skip_value(scan))
+		{
+			return(false);
+		}
+		acl_codec_skip_ws(scan);
+		if(scan->pos >= scan->end)
+			return(false);
+		if(*scan->pos == ']')
+		{
+			scan->pos++;
+			return(true);
+		}
+		if(*scan->pos != ',')
+			return(false);
+		scan->pos++;
+	}
+}
+
+/* decodes one byte of binary acl */
+static bool acl_codec_bin_byte(acl_codec_bin_t *bin, uint8_t byte, acl_codec_doc_t *doc, acl_codec_entry_cb_t cb, void *arg)
+{
+	uint64_t card_id;
+	uint8_t slots;
+	int8_t i;
+
+	if(!bin->has_flags)
+	{
+		bin->flags = byte;
+		bin->has_flags = true;
+		return(true);
+	}
+	if(bin->flags & ACL_CODEC_BIN_DELTA)
+	{
+		if(!bin->has_delta) /* varint card id difference */
+		{
+			if(bin->shift > 56)
+				return(false);
+			bin->delta |= (uint64_t)(byte & 0x7F) << bin->shift;
+			bin->shift += 7;
+			if(!(byte & 0x80))
+				bin->has_delta = true;
+			return(true);
+		}
+		if((bin->has_card && !bin->delta) || bin->delta > ACL_CODEC_MAX_CARD_ID - bin->card_id) /* not sorted or too wide */
+			return(false);
+		bin->card_id += bin->delta;
+		bin->has_card = true;
+		card_id = bin->card_id;
+		slots = byte;
+		bin->delta = 0;
+		bin->shift = 0;
+		bin->has_delta = false;
+	}
+	else
+	{
+		bin->record[bin->record_len++] = byte;
+		if(bin->record_len < sizeof(bin->record))
+			return(true);
+		card_id = 0;
+		for(i = 4; i >= 0; i--)
+			card_id = (card_id << 8) | bin->record[i];
+		slots = bin->record[5];
+		bin->record_len = 0;
+	}
+	doc->entries++;
+	return(!cb || cb(card_id, slots, arg));
+}
+
+/* decodes base64 string straight into acl entries */
+static bool acl_codec_scan_bin(acl_codec_scan_t *scan, acl_codec_doc_t *doc, acl_codec_entry_cb_t cb, void *arg)
+{
+	acl_codec_bin_t bin = {};
+	const char *str;
+	size_t len;
+	size_t i;
+	uint32_t bits = 0;
+	uint8_t bits_len = 0;
+	int digit;
+
+	if(!acl_codec_scan_string(scan, &str, &len))
+		return(false);
+	for(i = 0; i < len && str[i] != '='; i++)
+	{
+		if(str[i] == '\\') /* escaped slash */
+			continue;
+		digit = acl_codec_base64_digit(str[i]);
+		if(digit < 0)
+			return(false);
+		bits = (bits << 6) | digit;
+		bits_len += 6;
+		if(bits_len >= 8)
+		{
+			bits_len -= 8;
+			if(!acl_codec_bin_byte(&bin, (uint8_t)(bits >> bits_len), doc, cb, arg))
+				return(false);
+		}
+	}
+	/* binary acl must end at a record boundary */
+	return(bin.has_flags && !bin.record_len && !bin.shift && !bin.has_delta);
+}
+
+static bool acl_codec_scan_object(acl_codec_scan_t *scan, acl_codec_doc_t *doc, acl_codec_entry_cb_t cb, void *arg)
+{
+	const char *key;
+	size_t key_len;
+	bool ret;
+
+	scan->pos++; /* opening brace */
+	acl_codec_skip_ws(scan);
+	if(scan->pos < scan->end && *scan->pos == '}')
+	{
+		scan->pos++;
+		return(true);
+	}
+	while(true)
+	{
+		acl_codec_skip_ws(scan);
+		if(!acl_codec_scan_string(scan, &key, &key_len))
+			return(false);
+		acl_codec_skip_ws(scan);
+		if(scan->pos >= scan->end || *scan->pos != ':')
+			return(false);
+		scan->pos++;
+		acl_codec_skip_ws(scan);
+		if(key_len == 1 && *key == 'v')
+		{
+			ret = acl_codec_scan_uint(scan, &doc->version);
+		}
+		else if(key_len == 3 && !memcmp(key, "bin", 3))
+		{
+			ret = acl_codec_scan_bin(scan, doc, cb, arg);
+			doc->has_acl = ret;
+		}
+		else if(key_len == 3 && !memcmp(key, "gen", 3))
+		{
+			ret = acl_codec_scan_uint(scan, &doc->generation);
+			doc->has_generation = ret;
+		}
+		else if(key_len == 3 && !memcmp(key, "acl", 3))
+		{
+			ret = acl_codec_scan_acl(scan, doc, cb, arg);
+			doc->has_acl = ret;
+		}
+		else
+		{
+			ret = acl_codec_skip_value(scan);
+		}
+		if(!ret)
+			return(false);
+		acl_codec_skip_ws(scan);
+		if(scan->pos >= scan->end)
+			return(false);
+		if(*scan->pos == '}')
+		{
+			scan->pos++;
+			return(true);
+		}
+		if(*scan->pos != ',')
+			return(false);
+		scan->pos++;
+	}
+}
+
+/* parses acl document, entries are passed to the callback if provided */
+bool acl_codec_parse_json(const char *buf, size_t len, acl_codec_doc_t *doc, acl_codec_entry_cb_t cb, void *arg)
+{
+	acl_codec_scan_t scan = {
+		.pos = buf,
+		.end = buf + len,
+	};
+	bool ret;
+
+	memset(doc, 0, sizeof(acl_codec_doc_t));
+	doc->version = 1;
+	acl_codec_skip_ws(&scan);
+	if(scan.pos >= scan.end)
+		return(false);
+	if(*scan.pos == '{')
+	{
+		ret = acl_codec_scan_object(&scan, doc, cb, arg);
+	}
+	else
+	{
+		ret = acl_codec_scan_acl(&scan, doc, cb, arg);
+		doc->has_acl = ret;
+	}
+	if(!ret || doc->version > ACL_CODEC_VERSION)
+		return(false);
+	/* only whitespace or string terminator may follow */
+	acl_codec_skip_ws(&scan);
+	return(scan.pos == scan.end || *scan.pos == '\0');
+}
+
+/* parses "hexid:slots" entry, slots are optional */
+bool acl_codec_parse_entry(const char *str, size_t len, uint64_t *card_id, uint8_t *slots)
+{
+	size_t i = 0;
+	size_t digits;
+	int digit;
+
+	*card_id = 0;
+	*slots = 0;
+	for(digits = 0; i < len && (digit = acl_codec_hex_digit(str[i])) >= 0; i++, digits++)
+		*card_id = (*card_id << 4) | digit;
+	if(!digits || digits > ACL_CODEC_MAX_ID_DIGITS)
+		return(false);
+	if(i == len)
+		return(true);
+	if(str[i++] != ':')
+		return(false);
+	for(digits = 0; i < len && (digit = acl_codec_hex_digit(str[i])) >= 0; i++, digits++)
+		*slots = (*slots << 4) | digit;
+	return(digits && digits <= ACL_CODEC_MAX_SLOTS_DIGITS && i == len);
+}
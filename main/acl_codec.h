@@ -0,0 +1,30 @@
+#ifndef MAIN_ACL_CODEC_H_
+#define MAIN_ACL_CODEC_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* highest acl document version understood by the device */
+#define ACL_CODEC_VERSION 2
+/* binary acl flags */
+#define ACL_CODEC_BIN_DELTA 0x01
+
+/* called for every acl entry, return false to stop parsing */
+typedef bool (*acl_codec_entry_cb_t)(uint64_t card_id, uint8_t slots, void *arg);
+
+/* acl document summary */
+typedef struct
+{
+	uint32_t version;
+	uint32_t generation;
+	bool has_generation;
+	bool has_acl;
+	uint32_t entries;
+	uint32_t skipped;
+} acl_codec_doc_t;
+
+bool acl_codec_parse_json(const char *buf, size_t len, acl_codec_doc_t *doc, acl_codec_entry_cb_t cb, void *arg);
+bool acl_codec_parse_entry(const char *str, size_t len, uint64_t *card_id, uint8_t *slots);
+
+#endif /* MAIN_ACL_CODEC_H_ */
@@ -0,0 +1,904 @@
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_spi_flash.h"
+#include "acl_store.h"
+
+/*
+
+PARTITION LAYOUT
+
+The partition is split into three equal regions, two banks and a scratch area.
+A bank holds the acl as records sorted by card id, packed into flash sectors
+(pages). The active bank is memory mapped and searched in place, only the first
+card id of every page is kept in RAM. Rebuilding writes sorted runs of one page
+to the scratch area, merges them into the inactive bank and switches banks by writing one NVS blob
+holding bank, card count and generation last, so a power loss keeps the
+previous acl.
+
+Incremental changes go to a small sorted overlay kept in RAM and NVS, which is
+searched before the bank. The overlay blob is tagged with the sequence number of
+the state it applies to, an overlay left over from before a bank switch is
+ignored. A full overlay is merged with the active bank into the inactive one.
+
+A Bloom filter over the active bank is rebuilt whenever a bank is mapped, most
+unknown cards are rejected by it without reading the bank.
+
+Devices updated over the air keep the partition table they were flashed with
+and may have no acl partition. The banks are then NVS blobs limited to
+ACL_STORE_LEGACY_LEN cards, bank 0 being the blob of older firmware. The active
+blob is loaded into the unused one of two RAM banks and sorted there. Once the
+partition is flashed, the active blob is imported into it.
+
+*/
+
+#define ACL_STORE_PAGE_SIZE SPI_FLASH_SEC_SIZE
+#define ACL_STORE_PAGE_RECORDS (ACL_STORE_PAGE_SIZE / sizeof(ac_t))
+#define ACL_STORE_MAX_PAGES 64
+#define ACL_STORE_REGIONS 3
+#define ACL_STORE_SCRATCH 2
+#define ACL_STORE_BLOOM_MAX_K 8
+
+static const char *acl_store_tag = "acl_store";
+
+static const esp_partition_t *acl_store_partition;
+static nvs_handle_t acl_store_nvs_handle;
+/* guards active bank mapping */
+static SemaphoreHandle_t acl_store_mutex;
+static size_t acl_store_region_pages;
+/* active bank */
+static uint8_t acl_store_bank;
+static uint32_t acl_store_records;
+static size_t acl_store_pages;
+static const uint8_t *acl_store_map;
+static spi_flash_mmap_handle_t acl_store_map_handle;
+/* page directory, first card id of every active page */
+static uint64_t acl_store_dir[ACL_STORE_MAX_PAGES];
+/* negative lookup filter over the active bank */
+static uint8_t *acl_store_bloom;
+static uint32_t acl_store_bloom_bits;
+static uint8_t acl_store_bloom_k;
+static acl_store_stats_t acl_store_stats;
+/* state in NVS, written last when switching banks */
+typedef struct {
+	uint32_t seq; /* bumped on every bank switch */
+	uint32_t gen; /* acl generation of the bank */
+	uint32_t records;
+	uint8_t bank;
+	uint8_t nvs; /* banks are NVS blobs, no acl partition */
+} acl_store_state_t;
+static acl_store_state_t acl_store_state;
+/* pending changes as stored in NVS */
+typedef struct {
+	uint32_t seq; /* state the changes apply to */
+	uint32_t gen; /* acl generation the changes lead to */
+	acl_store_delta_t entries[CONFIG_ACL_DELTA_MAX];
+} acl_store_overlay_t;
+static acl_store_overlay_t acl_store_overlay;
+/* acl generation and pending changes */
+static uint32_t acl_store_gen;
+/* bumped on every change of searchable content */
+static volatile uint32_t acl_store_rev;
+static acl_store_delta_t acl_store_delta[CONFIG_ACL_DELTA_MAX];
+static size_t acl_store_delta_len;
+/* rebuild state, single writer */
+static ac_t *acl_store_buf;
+static size_t acl_store_buf_len;
+static uint16_t acl_store_run_len[ACL_STORE_MAX_PAGES];
+static uint16_t acl_store_run_pos[ACL_STORE_MAX_PAGES];
+static size_t acl_store_runs;
+/* banks without acl partition */
+static ac_t acl_store_legacy[ACL_STORE_SCRATCH][ACL_STORE_LEGACY_LEN];
+static const char *acl_store_legacy_keys[ACL_STORE_SCRATCH] = {"acl", "acl_1"};
+
+static esp_err_t acl_store_map_bank(uint8_t bank, uint32_t records);
+static esp_err_t acl_store_set_state(uint8_t bank, uint32_t records, uint32_t generation);
+static esp_err_t acl_store_legacy_read(uint8_t bank, ac_t *buf, uint32_t *records);
+static esp_err_t acl_store_import(void);
+static esp_err_t acl_store_flush_run(void);
+static esp_err_t acl_store_merge(uint8_t bank, uint32_t *records);
+static esp_err_t acl_store_write_page(uint8_t bank, size_t page);
+static esp_err_t acl_store_compact(void);
+static esp_err_t acl_store_put(uint64_t card_id, uint8_t slots, bool removed);
+static esp_err_t acl_store_set_delta_blob(size_t len, uint32_t generation);
+static esp_err_t acl_store_drop_delta(void);
+static void acl_store_bloom_build(uint32_t records);
+static bool acl_store_bloom_check(uint64_t card_id, bool add);
+
+static inline uint64_t acl_store_card_id(const ac_t *record)
+{
+	uint64_t card_id = 0;
+	int8_t i;
+
+	for(i = CARD_ID_BYTE_4; i >= CARD_ID_BYTE_0; i--)
+		card_id = (card_id << 8) | record->data[i];
+	return(card_id);
+}
+
+static inline size_t acl_store_region_offset(uint8_t region)
+{
+	return(region * acl_store_region_pages * ACL_STORE_PAGE_SIZE);
+}
+
+/* RAM bank not mapped, used without acl partition */
+static inline ac_t *acl_store_legacy_free(void)
+{
+	return(acl_store_legacy[acl_store_map == (const uint8_t *)acl_store_legacy[0]]);
+}
+
+static int acl_store_compare(const void *a, const void *b)
+{
+	uint64_t id_a = acl_store_card_id(a);
+	uint64_t id_b = acl_store_card_id(b);
+
+	return((id_a > id_b) - (id_a < id_b));
+}
+
+/* call once, maps the acl stored in the partition, the acl is kept in NVS without partition */
+esp_err_t acl_store_init(const esp_partition_t *partition, nvs_handle_t nvs_handle)
+{
+	esp_err_t ret;
+
+	/* lookups are safe even if the store fails to load */
+	acl_store_mutex = xSemaphoreCreateMutex();
+	if(!acl_store_mutex)
+		return(ESP_ERR_NO_MEM);
+	acl_store_partition = partition;
+	acl_store_nvs_handle = nvs_handle;
+	if(partition)
+	{
+		acl_store_region_pages = partition->size / ACL_STORE_PAGE_SIZE / ACL_STORE_REGIONS;
+		if(acl_store_region_pages > ACL_STORE_MAX_PAGES)
+			acl_store_region_pages = ACL_STORE_MAX_PAGES;
+		if(!acl_store_region_pages)
+			return(ESP_ERR_INVALID_SIZE);
+	}
+	else
+	{
+		ESP_LOGW(acl_store_tag, "No acl partition, flash it with partitions.csv to store more than %u cards", ACL_STORE_LEGACY_LEN);
+	}
+	if(CONFIG_ACL_BLOOM_SIZE)
+	{
+		acl_store_bloom = malloc(CONFIG_ACL_BLOOM_SIZE);
+		if(!acl_store_bloom)
+			return(ESP_ERR_NO_MEM);
+		acl_store_bloom_bits = CONFIG_ACL_BLOOM_SIZE * 8;
+	}
+	ESP_LOGI(acl_store_tag, "Capacity %u cards", acl_store_capacity());
+	ret = acl_store_load();
+	if(ret == ESP_OK && partition && acl_store_state.nvs)
+		ret = acl_store_import();
+	return(ret);
+}
+
+/* maps the bank selected in NVS and loads pending changes */
+esp_err_t acl_store_load(void)
+{
+	const size_t head = offsetof(acl_store_overlay_t, entries);
+	acl_store_state_t state;
+	size_t size = sizeof(state);
+	size_t delta_size = 0;
+	uint32_t records = 0;
+	uint32_t gen = 0;
+	uint8_t counter = 0;
+	bool mapped;
+	bool drop = false;
+	esp_err_t ret;
+
+	memset(&state, 0, sizeof(state));
+	ret = nvs_get_blob(acl_store_nvs_handle, "acl_state", &state, &size);
+	if(ret == ESP_OK && size != sizeof(state))
+		ret = ESP_ERR_INVALID_SIZE;
+	if(ret == ESP_ERR_NVS_NOT_FOUND && !acl_store_partition) /* older firmware kept the acl in bank 0 */
+	{
+		state.nvs = 1;
+		ret = nvs_get_u8(acl_store_nvs_handle, "acl_counter", &counter);
+		state.records = counter;
+	}
+	if(ret == ESP_ERR_NVS_NOT_FOUND) /* nothing stored yet */
+		ret = ESP_OK;
+	/* banks kept in NVS are imported by acl_store_init() once there is a partition */
+	mapped = (state.nvs != 0) == (acl_store_partition == NULL);
+	if(ret == ESP_OK && (state.bank >= ACL_STORE_SCRATCH || (mapped && state.records > acl_store_capacity())))
+	{
+		ESP_LOGE(acl_store_tag, "Invalid state bank %u, count %u", state.bank, state.records);
+		return(ESP_ERR_INVALID_STATE);
+	}
+	if(ret == ESP_OK && mapped)
+	{
+		records = state.records;
+		gen = state.gen;
+		if(state.nvs)
+			ret = acl_store_legacy_read(state.bank, acl_store_legacy_free(), &records);
+	}
+	if(ret == ESP_OK)
+		ret = nvs_get_blob(acl_store_nvs_handle, "acl_delta", NULL, &delta_size);
+	if(ret == ESP_OK && (delta_size < head || delta_size > sizeof(acl_store_overlay) || (delta_size - head) % sizeof(acl_store_delta_t)))
+	{
+		/* written by a build with a larger overlay, the generation of the bank makes the cloud send the changes again */
+		ESP_LOGW(acl_store_tag, "Dropping %u bytes of pending changes, generation %u", delta_size, gen);
+		drop = true;
+	}
+	else if(ret == ESP_OK)
+	{
+		ret = nvs_get_blob(acl_store_nvs_handle, "acl_delta", &acl_store_overlay, &delta_size);
+		/* left over from before the last bank switch */
+		drop = ret == ESP_OK && (acl_store_overlay.seq != state.seq || !mapped);
+	}
+	else if(ret == ESP_ERR_NVS_NOT_FOUND)
+	{
+		ret = ESP_OK;
+	}
+	if(ret == ESP_OK && drop)
+		ret = acl_store_drop_delta();
+	if(ret != ESP_OK)
+	{
+		ESP_LOGE(acl_store_tag, "Error reading state %d", ret);
+		return(ret);
+	}
+	if(drop)
+		delta_size = 0;
+	ret = acl_store_map_bank(state.bank, records);
+	if(ret != ESP_OK)
+		return(ret);
+	xSemaphoreTake(acl_store_mutex, portMAX_DELAY);
+	acl_store_state = state;
+	acl_store_gen = delta_size ? acl_store_overlay.gen : gen;
+	acl_store_delta_len = delta_size ? (delta_size - head) / sizeof(acl_store_delta_t) : 0;
+	memcpy(acl_store_delta, acl_store_overlay.entries, acl_store_delta_len * sizeof(acl_store_delta_t));
+	acl_store_rev++;
+	xSemaphoreGive(acl_store_mutex);
+	return(ESP_OK);
+}
+
+/* searches the active bank in place */
+bool acl_store_find(uint64_t card_id, uint8_t *slots)
+{
+	const ac_t *page;
+	size_t low = 0;
+	size_t high;
+	size_t mid;
+	uint64_t id;
+	bool found = false;
+
+	xSemaphoreTake(acl_store_mutex, portMAX_DELAY);
+	/* pending changes take precedence */
+	high = acl_store_delta_len;
+	while(low < high)
+	{
+		mid = low + (high - low) / 2;
+		id = acl_store_card_id(&acl_store_delta[mid].record);
+		if(id == card_id)
+		{
+			found = !acl_store_delta[mid].removed;
+			if(found && slots)
+				*slots = acl_store_delta[mid].record.data[SLOTS_BYTE];
+			xSemaphoreGive(acl_store_mutex);
+			return(found);
+		}
+		if(id < card_id)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	acl_store_stats.bank_lookups++;
+	if(!acl_store_bloom_check(card_id, false))
+	{
+		acl_store_stats.filter_rejects++;
+		xSemaphoreGive(acl_store_mutex);
+		return(false);
+	}
+	/* last page starting at or below card id */
+	low = 0;
+	high = acl_store_pages;
+	while(low < high)
+	{
+		mid = low + (high - low) / 2;
+		if(acl_store_dir[mid] <= card_id)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if(low)
+	{
+		page = (const ac_t *)(acl_store_map + (low - 1) * ACL_STORE_PAGE_SIZE);
+		high = (low == acl_store_pages) ? acl_store_records - (low - 1) * ACL_STORE_PAGE_RECORDS : ACL_STORE_PAGE_RECORDS;
+		low = 0;
+		while(low < high)
+		{
+			mid = low + (high - low) / 2;
+			id = acl_store_card_id(&page[mid]);
+			if(id == card_id)
+			{
+				if(slots)
+					*slots = page[mid].data[SLOTS_BYTE];
+				found = true;
+				break;
+			}
+			if(id < card_id)
+				low = mid + 1;
+			else
+				high = mid;
+		}
+	}
+	if(!found && acl_store_bloom) /* filter passed a card the bank does not hold */
+		acl_store_stats.filter_false_positives++;
+	xSemaphoreGive(acl_store_mutex);
+	return(found);
+}
+
+/* lookup counters and Bloom filter false positive rate */
+void acl_store_get_stats(acl_store_stats_t *stats)
+{
+	uint32_t negatives;
+
+	xSemaphoreTake(acl_store_mutex, portMAX_DELAY);
+	*stats = acl_store_stats;
+	xSemaphoreGive(acl_store_mutex);
+	negatives = stats->filter_rejects + stats->filter_false_positives;
+	stats->filter_fp_rate = negatives ? (float)stats->filter_false_positives / negatives : 0.0f;
+}
+
+uint32_t acl_store_count(void)
+{
+	return(acl_store_records);
+}
+
+uint32_t acl_store_capacity(void)
+{
+	if(!acl_store_partition)
+		return(ACL_STORE_LEGACY_LEN);
+	return(acl_store_region_pages * ACL_STORE_PAGE_RECORDS);
+}
+
+uint32_t acl_store_generation(void)
+{
+	return(acl_store_gen);
+}
+
+/* changes whenever a lookup result may change, for caching lookups */
+uint32_t acl_store_revision(void)
+{
+	return(acl_store_rev);
+}
+
+/* adds a card or changes its slots, kept in RAM until acl_store_save_delta() */
+esp_err_t acl_store_set(uint64_t card_id, uint8_t slots)
+{
+	return(acl_store_put(card_id, slots, false));
+}
+
+/* removes a card, kept in RAM until acl_store_save_delta() */
+esp_err_t acl_store_remove(uint64_t card_id)
+{
+	return(acl_store_put(card_id, 0, true));
+}
+
+/* stores pending changes together with the acl generation they lead to */
+esp_err_t acl_store_save_delta(uint32_t generation)
+{
+	esp_err_t ret;
+
+	ret = acl_store_set_delta_blob(acl_store_delta_len, generation);
+	if(ret == ESP_OK)
+		ret = nvs_commit(acl_store_nvs_handle);
+	if(ret != ESP_OK)
+	{
+		ESP_LOGE(acl_store_tag, "Error saving changes %d", ret);
+		acl_store_load(); /* drop unsaved changes */
+		return(ret);
+	}
+	acl_store_gen = generation;
+	ESP_LOGI(acl_store_tag, "Generation %u, %u pending changes", generation, acl_store_delta_len);
+	return(ESP_OK);
+}
+
+/* starts building a new acl, the active one is used until commit */
+esp_err_t acl_store_begin(void)
+{
+	acl_store_abort();
+	acl_store_buf = malloc(ACL_STORE_PAGE_RECORDS * sizeof(ac_t));
+	if(!acl_store_buf)
+		return(ESP_ERR_NO_MEM);
+	acl_store_buf_len = 0;
+	acl_store_runs = 0;
+	return(ESP_OK);
+}
+
+/* adds an entry to the acl being built, order does not matter */
+esp_err_t acl_store_add(uint64_t card_id, uint8_t slots)
+{
+	esp_err_t ret;
+	int8_t i;
+
+	if(!acl_store_buf)
+		return(ESP_ERR_INVALID_STATE);
+	if(acl_store_runs * ACL_STORE_PAGE_RECORDS + acl_store_buf_len >= acl_store_capacity())
+	{
+		ESP_LOGW(acl_store_tag, "Full, card %llu dropped", card_id);
+		return(ESP_ERR_NO_MEM);
+	}
+	if(acl_store_buf_len == ACL_STORE_PAGE_RECORDS)
+	{
+		ret = acl_store_flush_run();
+		if(ret != ESP_OK)
+			return(ret);
+	}
+	for(i = CARD_ID_BYTE_0; i <= CARD_ID_BYTE_4; i++)
+		acl_store_buf[acl_store_buf_len].data[i] = (uint8_t)(card_id >> (8 * i));
+	acl_store_buf[acl_store_buf_len].data[SLOTS_BYTE] = slots;
+	acl_store_buf_len++;
+	return(ESP_OK);
+}
+
+/* sorts the new acl into the inactive bank and switches to it */
+esp_err_t acl_store_commit(uint32_t generation)
+{
+	uint8_t bank = !acl_store_bank;
+	uint32_t records = 0;
+	esp_err_t ret;
+
+	if(!acl_store_buf)
+		return(ESP_ERR_INVALID_STATE);
+	ret = acl_store_flush_run();
+	if(ret == ESP_OK)
+		ret = acl_store_merge(bank, &records);
+	if(ret == ESP_OK)
+		ret = acl_store_set_state(bank, records, generation);
+	acl_store_abort();
+	if(ret != ESP_OK)
+	{
+		ESP_LOGE(acl_store_tag, "Commit failed %d", ret);
+		return(ret);
+	}
+	ESP_LOGI(acl_store_tag, "Stored %u cards in bank %u, generation %u", records, bank, generation);
+	return(acl_store_load());
+}
+
+/* drops the acl being built */
+void acl_store_abort(void)
+{
+	free(acl_store_buf);
+	acl_store_buf = NULL;
+	acl_store_buf_len = 0;
+	acl_store_runs = 0;
+}
+
+/* maps a bank and swaps it in as the active one */
+static esp_err_t acl_store_map_bank(uint8_t bank, uint32_t records)
+{
+	static uint64_t dir[ACL_STORE_MAX_PAGES];
+	const void *map = NULL;
+	spi_flash_mmap_handle_t handle = 0;
+	spi_flash_mmap_handle_t old_handle;
+	bool old_mapped;
+	size_t pages = (records + ACL_STORE_PAGE_RECORDS - 1) / ACL_STORE_PAGE_RECORDS;
+	size_t i;
+	esp_err_t ret;
+
+	if(pages && !acl_store_partition)
+	{
+		map = acl_store_legacy_free();
+	}
+	else if(pages)
+	{
+		ret = esp_partition_mmap(acl_store_partition, acl_store_region_offset(bank), pages * ACL_STORE_PAGE_SIZE, SPI_FLASH_MMAP_DATA, &map, &handle);
+		if(ret != ESP_OK)
+		{
+			ESP_LOGE(acl_store_tag, "Error mapping bank %u", bank);
+			return(ret);
+		}
+	}
+	if(pages)
+	{
+		for(i = 0; i < pages; i++)
+			dir[i] = acl_store_card_id((const ac_t *)((const uint8_t *)map + i * ACL_STORE_PAGE_SIZE));
+	}
+	xSemaphoreTake(acl_store_mutex, portMAX_DELAY);
+	old_handle = acl_store_map_handle;
+	old_mapped = acl_store_map_handle != 0; /* RAM banks have no handle */
+	acl_store_map = map;
+	acl_store_map_handle = handle;
+	acl_store_bank = bank;
+	acl_store_records = records;
+	acl_store_pages = pages;
+	memcpy(acl_store_dir, dir, pages * sizeof(dir[0]));
+	acl_store_bloom_build(records);
+	acl_store_rev++;
+	xSemaphoreGive(acl_store_mutex);
+	if(old_mapped)
+		spi_flash_munmap(old_handle);
+	ESP_LOGD(acl_store_tag, "Bank %u mapped, %u cards in %u pages", bank, records, pages);
+	return(ESP_OK);
+}
+
+/* sorts buffered records and stores them as one run in the scratch area */
+static esp_err_t acl_store_flush_run(void)
+{
+	size_t offset;
+	esp_err_t ret;
+
+	if(!acl_store_buf_len)
+		return(ESP_OK);
+	if(!acl_store_partition) /* whole acl fits the buffer, merged in place */
+	{
+		qsort(acl_store_buf, acl_store_buf_len, sizeof(ac_t), acl_store_compare);
+		return(ESP_OK);
+	}
+	if(acl_store_runs >= acl_store_region_pages)
+		return(ESP_ERR_NO_MEM);
+	qsort(acl_store_buf, acl_store_buf_len, sizeof(ac_t), acl_store_compare);
+	offset = acl_store_region_offset(ACL_STORE_SCRATCH) + acl_store_runs * ACL_STORE_PAGE_SIZE;
+	ret = esp_partition_erase_range(acl_store_partition, offset, ACL_STORE_PAGE_SIZE);
+	if(ret == ESP_OK)
+		ret = esp_partition_write(acl_store_partition, offset, acl_store_buf, acl_store_buf_len * sizeof(ac_t));
+	if(ret != ESP_OK)
+		return(ret);
+	acl_store_run_len[acl_store_runs] = acl_store_buf_len;
+	acl_store_runs++;
+	acl_store_buf_len = 0;
+	return(ESP_OK);
+}
+
+/* k-way merge of the sorted runs into a bank, duplicated card ids are stored once */
+static esp_err_t acl_store_merge(uint8_t bank, uint32_t *records)
+{
+	const void *scratch = NULL;
+	const ac_t *record;
+	spi_flash_mmap_handle_t handle = 0;
+	uint64_t best_id = 0;
+	uint64_t last_id = 0;
+	uint64_t id;
+	size_t best;
+	size_t pages = 0;
+	size_t i;
+	uint32_t count = 0;
+	esp_err_t ret = ESP_OK;
+
+	if(!acl_store_partition) /* sorted acl in buffer, duplicates dropped in place */
+	{
+		for(i = 0; i < acl_store_buf_len; i++)
+		{
+			if(count && acl_store_card_id(&acl_store_buf[i]) == acl_store_card_id(&acl_store_buf[count - 1]))
+				continue;
+			acl_store_buf[count++] = acl_store_buf[i];
+		}
+		acl_store_buf_len = count;
+		*records = count;
+		return(acl_store_write_page(bank, 0));
+	}
+	if(!acl_store_runs)
+	{
+		*records = 0;
+		return(ESP_OK);
+	}
+	ret = esp_partition_mmap(acl_store_partition, acl_store_region_offset(ACL_STORE_SCRATCH), acl_store_runs * ACL_STORE_PAGE_SIZE, SPI_FLASH_MMAP_DATA, &scratch, &handle);
+	if(ret != ESP_OK)
+		return(ret);
+	memset(acl_store_run_pos, 0, sizeof(acl_store_run_pos));
+	while(true)
+	{
+		best = acl_store_runs;
+		for(i = 0; i < acl_store_runs; i++)
+		{
+			if(acl_store_run_pos[i] >= acl_store_run_len[i])
+				continue;
+			record = (const ac_t *)((const uint8_t *)scratch + i * ACL_STORE_PAGE_SIZE) + acl_store_run_pos[i];
+			id = acl_store_card_id(record);
+			if(best == acl_store_runs || id < best_id)
+			{
+				best = i;
+				best_id = id;
+			}
+		}
+		if(best == acl_store_runs) /* all runs merged */
+			break;
+		record = (const ac_t *)((const uint8_t *)scratch + best * ACL_STORE_PAGE_SIZE) + acl_store_run_pos[best];
+		acl_store_run_pos[best]++;
+		if(count && best_id == last_id)
+			continue;
+		last_id = best_id;
+		acl_store_buf[acl_store_buf_len++] = *record;
+		count++;
+		if(acl_store_buf_len == ACL_STORE_PAGE_RECORDS)
+		{
+			ret = acl_store_write_page(bank, pages++);
+			if(ret != ESP_OK)
+				break;
+		}
+	}
+	if(ret == ESP_OK && acl_store_buf_len)
+		ret = acl_store_write_page(bank, pages);
+	spi_flash_munmap(handle);
+	*records = count;
+	return(ret);
+}
+
+/* writes buffered records to a bank page */
+static esp_err_t acl_store_write_page(uint8_t bank, size_t page)
+{
+	size_t offset = acl_store_region_offset(bank) + page * ACL_STORE_PAGE_SIZE;
+	esp_err_t ret;
+
+	if(!acl_store_partition) /* single page kept as an NVS blob */
+	{
+		ret = nvs_set_blob(acl_store_nvs_handle, acl_store_legacy_keys[bank], acl_store_buf, acl_store_buf_len * sizeof(ac_t));
+		acl_store_buf_len = 0;
+		return(ret);
+	}
+	ret = esp_partition_erase_range(acl_store_partition, offset, ACL_STORE_PAGE_SIZE);
+	if(ret == ESP_OK)
+		ret = esp_partition_write(acl_store_partition, offset, acl_store_buf, acl_store_buf_len * sizeof(ac_t));
+	acl_store_buf_len = 0;
+	return(ret);
+}
+
+/* inserts or replaces a pending change, merges changes into a bank when full */
+static esp_err_t acl_store_put(uint64_t card_id, uint8_t slots, bool removed)
+{
+	acl_store_delta_t entry;
+	size_t low = 0;
+	size_t high;
+	size_t mid;
+	uint64_t id;
+	int8_t i;
+	esp_err_t ret;
+
+	for(i = CARD_ID_BYTE_0; i <= CARD_ID_BYTE_4; i++)
+		entry.record.data[i] = (uint8_t)(card_id >> (8 * i));
+	entry.record.data[SLOTS_BYTE] = slots;
+	entry.removed = removed;
+	xSemaphoreTake(acl_store_mutex, portMAX_DELAY);
+	high = acl_store_delta_len;
+	while(low < high)
+	{
+		mid = low + (high - low) / 2;
+		id = acl_store_card_id(&acl_store_delta[mid].record);
+		if(id < card_id)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if(low < acl_store_delta_len && acl_store_card_id(&acl_store_delta[low].record) == card_id)
+	{
+		acl_store_delta[low] = entry;
+		acl_store_rev++;
+		xSemaphoreGive(acl_store_mutex);
+		return(ESP_OK);
+	}
+	if(acl_store_delta_len < CONFIG_ACL_DELTA_MAX)
+	{
+		memmove(&acl_store_delta[low + 1], &acl_store_delta[low], (acl_store_delta_len - low) * sizeof(acl_store_delta_t));
+		acl_store_delta[low] = entry;
+		acl_store_delta_len++;
+		acl_store_rev++;
+		xSemaphoreGive(acl_store_mutex);
+		return(ESP_OK);
+	}
+	xSemaphoreGive(acl_store_mutex);
+	ret = acl_store_compact();
+	if(ret != ESP_OK)
+		return(ret);
+	return(acl_store_put(card_id, slots, removed));
+}
+
+/* merges pending changes with the active bank into the inactive one */
+static esp_err_t acl_store_compact(void)
+{
+	const ac_t *base = (const ac_t *)acl_store_map;
+	const ac_t *record;
+	uint8_t bank = !acl_store_bank;
+	uint32_t base_len = acl_store_records;
+	uint32_t base_pos = 0;
+	uint32_t count = 0;
+	uint64_t base_id;
+	uint64_t delta_id;
+	size_t delta_pos = 0;
+	size_t pages = 0;
+	bool removed;
+	esp_err_t ret = ESP_OK;
+
+	ESP_LOGI(acl_store_tag, "Merging %u changes into %u cards", acl_store_delta_len, base_len);
+	acl_store_abort();
+	acl_store_buf = malloc(ACL_STORE_PAGE_RECORDS * sizeof(ac_t));
+	if(!acl_store_buf)
+		return(ESP_ERR_NO_MEM);
+	while(base_pos < base_len || delta_pos < acl_store_delta_len)
+	{
+		/* records are packed into pages, each page starts at a sector */
+		base_id = base_pos < base_len ? acl_store_card_id((const ac_t *)((const uint8_t *)base + (base_pos / ACL_STORE_PAGE_RECORDS) * ACL_STORE_PAGE_SIZE) + base_pos % ACL_STORE_PAGE_RECORDS) : UINT64_MAX;
+		delta_id = delta_pos < acl_store_delta_len ? acl_store_card_id(&acl_store_delta[delta_pos].record) : UINT64_MAX;
+		if(delta_id <= base_id)
+		{
+			record = &acl_store_delta[delta_pos].record;
+			removed = acl_store_delta[delta_pos].removed;
+			delta_pos++;
+			if(delta_id == base_id) /* replaced */
+				base_pos++;
+		}
+		else
+		{
+			record = (const ac_t *)((const uint8_t *)base + (base_pos / ACL_STORE_PAGE_RECORDS) * ACL_STORE_PAGE_SIZE) + base_pos % ACL_STORE_PAGE_RECORDS;
+			removed = false;
+			base_pos++;
+		}
+		if(removed)
+			continue;
+		if(count >= acl_store_capacity())
+		{
+			ret = ESP_ERR_NO_MEM;
+			break;
+		}
+		acl_store_buf[acl_store_buf_len++] = *record;
+		count++;
+		if(acl_store_buf_len == ACL_STORE_PAGE_RECORDS)
+		{
+			ret = acl_store_write_page(bank, pages++);
+			if(ret != ESP_OK)
+				break;
+		}
+	}
+	if(ret == ESP_OK && acl_store_buf_len)
+		ret = acl_store_write_page(bank, pages);
+	/* generation is unchanged, changes are not lost if saving the next one fails */
+	if(ret == ESP_OK)
+		ret = acl_store_set_state(bank, count, acl_store_gen);
+	acl_store_abort();
+	if(ret != ESP_OK)
+	{
+		ESP_LOGE(acl_store_tag, "Merge failed %d", ret);
+		return(ret);
+	}
+	return(acl_store_load());
+}
+
+/* switches to a written bank with one blob, pending changes are merged into it */
+static esp_err_t acl_store_set_state(uint8_t bank, uint32_t records, uint32_t generation)
+{
+	acl_store_state_t state = {
+		.seq = acl_store_state.seq + 1,
+		.gen = generation,
+		.records = records,
+		.bank = bank,
+		.nvs = !acl_store_partition,
+	};
+	esp_err_t ret;
+
+	ret = nvs_set_blob(acl_store_nvs_handle, "acl_state", &state, sizeof(state));
+	if(ret == ESP_OK)
+		ret = nvs_commit(acl_store_nvs_handle);
+	if(ret != ESP_OK)
+		return(ret);
+	/* stale overlay is ignored on load if this fails */
+	if(acl_store_drop_delta() != ESP_OK)
+		ESP_LOGW(acl_store_tag, "Error dropping merged changes");
+	return(ESP_OK);
+}
+
+/* reads and sorts a bank kept in NVS, at most *records cards */
+static esp_err_t acl_store_legacy_read(uint8_t bank, ac_t *buf, uint32_t *records)
+{
+	size_t size = ACL_STORE_LEGACY_LEN * sizeof(ac_t);
+	esp_err_t ret;
+
+	ret = nvs_get_blob(acl_store_nvs_handle, acl_store_legacy_keys[bank], buf, &size);
+	if(ret == ESP_ERR_NVS_NOT_FOUND) /* nothing stored yet */
+	{
+		*records = 0;
+		return(ESP_OK);
+	}
+	if(ret != ESP_OK)
+		return(ret);
+	if(*records > size / sizeof(ac_t))
+		*records = size / sizeof(ac_t);
+	qsort(buf, *records, sizeof(ac_t), acl_store_compare);
+	return(ESP_OK);
+}
+
+/* moves the bank kept in NVS before the acl partition was flashed into the partition */
+static esp_err_t acl_store_import(void)
+{
+	ac_t *buf = acl_store_legacy[0];
+	uint32_t records = acl_store_state.records;
+	uint32_t i;
+	uint8_t bank;
+	esp_err_t ret;
+
+	ret = acl_store_legacy_read(acl_store_state.bank, buf, &records);
+	if(ret == ESP_OK)
+		ret = acl_store_begin();
+	for(i = 0; ret == ESP_OK && i < records; i++)
+		ret = acl_store_add(acl_store_card_id(&buf[i]), buf[i].data[SLOTS_BYTE]);
+	if(ret == ESP_OK)
+		ret = acl_store_commit(acl_store_state.gen);
+	if(ret != ESP_OK)
+	{
+		acl_store_abort();
+		ESP_LOGE(acl_store_tag, "Error importing %u cards from NVS %d", records, ret);
+		return(ret);
+	}
+	for(bank = 0; bank < ACL_STORE_SCRATCH; bank++)
+		nvs_erase_key(acl_store_nvs_handle, acl_store_legacy_keys[bank]);
+	nvs_erase_key(acl_store_nvs_handle, "acl_counter");
+	nvs_commit(acl_store_nvs_handle);
+	ESP_LOGI(acl_store_tag, "Imported %u cards from NVS", records);
+	return(ESP_OK);
+}
+
+/* writes pending changes to NVS without committing, tagged with the active state */
+static esp_err_t acl_store_set_delta_blob(size_t len, uint32_t generation)
+{
+	acl_store_overlay.seq = acl_store_state.seq;
+	acl_store_overlay.gen = generation;
+	memcpy(acl_store_overlay.entries, acl_store_delta, len * sizeof(acl_store_delta_t));
+	return(nvs_set_blob(acl_store_nvs_handle, "acl_delta", &acl_store_overlay, offsetof(acl_store_overlay_t, entries) + len * sizeof(acl_store_delta_t)));
+}
+
+/* erases and commits stored pending changes */
+static esp_err_t acl_store_drop_delta(void)
+{
+	esp_err_t ret;
+
+	ret = nvs_erase_key(acl_store_nvs_handle, "acl_delta");
+	if(ret == ESP_ERR_NVS_NOT_FOUND)
+		return(ESP_OK);
+	if(ret == ESP_OK)
+		ret = nvs_commit(acl_store_nvs_handle);
+	return(ret);
+}
+
+/* fills the filter with all cards of the active bank, called with mutex taken */
+static void acl_store_bloom_build(uint32_t records)
+{
+	uint32_t i;
+	float fill;
+
+	if(!acl_store_bloom)
+		return;
+	memset(acl_store_bloom, 0, acl_store_bloom_bits / 8);
+	/* optimal number of hashes for the filter size */
+	acl_store_bloom_k = records ? (uint8_t)lroundf((float)acl_store_bloom_bits / records * (float)M_LN2) : 1;
+	if(acl_store_bloom_k < 1)
+		acl_store_bloom_k = 1;
+	if(acl_store_bloom_k > ACL_STORE_BLOOM_MAX_K)
+		acl_store_bloom_k = ACL_STORE_BLOOM_MAX_K;
+	for(i = 0; i < records; i++)
+		acl_store_bloom_check(acl_store_card_id((const ac_t *)(acl_store_map + (i / ACL_STORE_PAGE_RECORDS) * ACL_STORE_PAGE_SIZE) + i % ACL_STORE_PAGE_RECORDS), true);
+	fill = 1.0f - expf(-(float)acl_store_bloom_k * records / acl_store_bloom_bits);
+	acl_store_stats.filter_fp_estimate = powf(fill, acl_store_bloom_k);
+	ESP_LOGI(acl_store_tag, "Filter %u bits, %u hashes, estimated false positive rate %.4f", acl_store_bloom_bits, acl_store_bloom_k, acl_store_stats.filter_fp_estimate);
+}
+
+/* tests or sets filter bits of a card, always passes without filter */
+static bool acl_store_bloom_check(uint64_t card_id, bool add)
+{
+	uint64_t hash = card_id;
+	uint32_t h1;
+	uint32_t h2;
+	uint32_t bit;
+	uint8_t i;
+
+	if(!acl_store_bloom)
+		return(true);
+	/* 64 bit mix, halves are used for double hashing */
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCDULL;
+	hash ^= hash >> 33;
+	hash *= 0xC4CEB9FE1A85EC53ULL;
+	hash ^= hash >> 33;
+	h1 = (uint32_t)hash;
+	h2 = (uint32_t)(hash >> 32) | 1;
+	for(i = 0; i < acl_store_bloom_k; i++)
+	{
+		bit = (h1 + i * h2) % acl_store_bloom_bits;
+		if(add)
+			acl_store_bloom[bit / 8] |= 1 << (bit % 8);
+		else if(!(acl_store_bloom[bit / 8] & (1 << (bit % 8))))
+			return(false);
+	}
+	return(true);
+}
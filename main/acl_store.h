@@ -0,0 +1,58 @@
+#ifndef MAIN_ACL_STORE_H_
+#define MAIN_ACL_STORE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "nvs.h"
+
+/* cards kept in the NVS blob of older firmware, used without acl partition */
+#define ACL_STORE_LEGACY_LEN 100
+
+/* acl record, card id little endian in bytes 0..4 followed by slots byte */
+typedef union {
+	uint8_t data[6];
+} ac_t;
+
+typedef enum {
+	CARD_ID_BYTE_0,
+	CARD_ID_BYTE_1,
+	CARD_ID_BYTE_2,
+	CARD_ID_BYTE_3,
+	CARD_ID_BYTE_4,
+	SLOTS_BYTE
+} acl_byte_map;
+
+/* pending acl change */
+typedef struct {
+	ac_t record;
+	uint8_t removed;
+} acl_store_delta_t;
+
+/* lookup statistics */
+typedef struct {
+	uint32_t bank_lookups;
+	uint32_t filter_rejects;
+	uint32_t filter_false_positives;
+	float filter_fp_rate;
+	float filter_fp_estimate;
+} acl_store_stats_t;
+
+esp_err_t acl_store_init(const esp_partition_t *partition, nvs_handle_t nvs_handle);
+esp_err_t acl_store_load(void);
+bool acl_store_find(uint64_t card_id, uint8_t *slots);
+uint32_t acl_store_count(void);
+uint32_t acl_store_capacity(void);
+uint32_t acl_store_generation(void);
+uint32_t acl_store_revision(void);
+void acl_store_get_stats(acl_store_stats_t *stats);
+esp_err_t acl_store_set(uint64_t card_id, uint8_t slots);
+esp_err_t acl_store_remove(uint64_t card_id);
+esp_err_t acl_store_save_delta(uint32_t generation);
+esp_err_t acl_store_begin(void);
+esp_err_t acl_store_add(uint64_t card_id, uint8_t slots);
+esp_err_t acl_store_commit(uint32_t generation);
+void acl_store_abort(void);
+
+#endif /* MAIN_ACL_STORE_H_ */
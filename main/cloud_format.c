@@ -0,0 +1,98 @@
+#include <stdbool.h>
+#include <string.h>
+#include "cloud_format.h"
+
+/* report data paths, also keys of batched reports */
+static const char *cloud_format_paths[REPORT_KIND_MAX] = {
+		"slotOpen",
+		"newCard",
+};
+
+static char *cloud_format_u64(char *buf, uint64_t value);
+
+/* LightDB stream path of a report kind */
+const char *cloud_format_path(report_kind_t kind)
+{
+	return(cloud_format_paths[kind]);
+}
+
+/* formats batch as {"slotOpen": ["..."], "newCard": ["..."]} into buffer of CLOUD_FORMAT_BATCH_LEN(count) + 1, returns length */
+size_t cloud_format_batch(char *buf, const report_data_t *reports, size_t count)
+{
+	char *pos = buf;
+	size_t i;
+	size_t key_len;
+	bool first_report;
+	report_kind_t kind;
+
+	*pos++ = '{';
+	for(kind = 0; kind < REPORT_KIND_MAX; kind++)
+	{
+		first_report = true;
+		for(i = 0; i < count; i++)
+		{
+			if(reports[i].kind != kind)
+				continue;
+			if(first_report)
+			{
+				if(pos - buf > 1)
+					*pos++ = ',';
+				key_len = strlen(cloud_format_paths[kind]);
+				*pos++ = '"';
+				memcpy(pos, cloud_format_paths[kind], key_len);
+				pos += key_len;
+				*pos++ = '"';
+				*pos++ = ':';
+				*pos++ = '[';
+			}
+			else
+			{
+				*pos++ = ',';
+			}
+			*pos++ = '"';
+			pos = cloud_format_report(pos, &reports[i]);
+			*pos++ = '"';
+			first_report = false;
+		}
+		if(!first_report)
+			*pos++ = ']';
+	}
+	*pos++ = '}';
+	*pos = '\0';
+	return(pos - buf);
+}
+
+/* writes "when,card_id" or "when,card_id,slot_id", summaries append ",count", without terminator, returns end */
+char *cloud_format_report(char *buf, const report_data_t *report)
+{
+	buf = cloud_format_u64(buf, (uint64_t)report->when);
+	*buf++ = ',';
+	buf = cloud_format_u64(buf, report->card_id);
+	if(report->kind == REPORT_KIND_SLOT_OPEN)
+	{
+		*buf++ = ',';
+		buf = cloud_format_u64(buf, report->slot_id);
+	}
+	if(report->summarised) /* number of reports replaced by summary */
+	{
+		*buf++ = ',';
+		buf = cloud_format_u64(buf, report->summarised);
+	}
+	return(buf);
+}
+
+/* writes decimal digits without terminator, returns end */
+static char *cloud_format_u64(char *buf, uint64_t value)
+{
+	char digits[20];
+	size_t len = 0;
+
+	do
+	{
+		digits[len++] = '0' + value % 10;
+		value /= 10;
+	} while(value);
+	while(len)
+		*buf++ = digits[--len];
+	return(buf);
+}
@@ -0,0 +1,16 @@
+#ifndef MAIN_CLOUD_FORMAT_H_
+#define MAIN_CLOUD_FORMAT_H_
+
+#include <stddef.h>
+#include "report_codec.h"
+
+/* longest report string "when,card_id,slot_id,count" with quotes and separator */
+#define CLOUD_FORMAT_REPORT_LEN (1 + 20 + 1 + 20 + 1 + 3 + 1 + 5 + 1 + 1)
+/* formatted batch size of n reports, each report kind adds its key */
+#define CLOUD_FORMAT_BATCH_LEN(n) (2 + REPORT_KIND_MAX * 16 + (n) * CLOUD_FORMAT_REPORT_LEN)
+
+const char *cloud_format_path(report_kind_t kind);
+char *cloud_format_report(char *buf, const report_data_t *report);
+size_t cloud_format_batch(char *buf, const report_data_t *reports, size_t count);
+
+#endif /* MAIN_CLOUD_FORMAT_H_ */
@@ -6,19 +6,28 @@
 #include "freertos/event_groups.h"
 #include "esp_log.h"
 #include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "nvs.h"
 #include "golioth.h"
 #include "cloud_manager.h"
 #include "access_manager.h"
+#include "acl_codec.h"
+#include "cloud_format.h"
 #include "version.h"
 
 #define CLOUD_EV_CONNECT_BIT BIT(0)
-/* report string formats */
-#define CLOUD_FORM_NEW_CARD(r) "%llu,%llu", (uint64_t)(r)->when, (r)->card_id
-#define CLOUD_FORM_SLOT_OPEN(r) "%llu,%llu,%d", (uint64_t)(r)->when, (r)->card_id, (r)->slot_id
+#define CLOUD_EV_RETRY_BIT BIT(1)
+#define CLOUD_EV_WAKE_BIT BIT(2)
+/* formatted batch size */
+#define CLOUD_BATCH_MAX_LEN CLOUD_FORMAT_BATCH_LEN(REPORT_BATCH_MAX)
 
 static void cloud_update_acl(golioth_client_t client);
 static void cloud_parse_acl_cb(golioth_client_t client, const golioth_response_t *rsp, const char *path, const  char *payload, size_t payload_size, void *arg);
+static void cloud_parse_acl_delta_cb(golioth_client_t client, const golioth_response_t *response, const char *path, const char *payload, size_t payload_size, void *arg);
+static bool cloud_apply_acl_ops(cJSON *ops, bool remove);
+static bool cloud_save_acl_entry_cb(uint64_t card_id, uint8_t privilage_to_slots, void *arg);
 
 typedef struct {
 		const char *name;
@@ -26,8 +35,11 @@ typedef struct {
 } cloud_numeric_rpc_t;
 
 static void cloud_client_cb(golioth_client_t client, golioth_client_event_t event, void* arg);
+static void cloud_ip_event_cb(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
 static golioth_rpc_status_t cloud_numeric_cb(const char* method, const cJSON* params, uint8_t* detail, size_t detail_size, void* callback_arg);
-static golioth_status_t cloud_report_exec(report_data_t *report);
+static void cloud_report_done_cb(golioth_client_t client, const golioth_response_t *response, const char *path, void *arg);
+static golioth_status_t cloud_report_exec(report_data_t *report, cloud_report_req_t *req);
+static golioth_status_t cloud_report_batch_exec(report_data_t *reports, size_t count, cloud_report_req_t *req);
 
 static const char *cloud_tag = "cloud";
 /* RPCs with a single numeric parameter */
@@ -41,11 +53,10 @@ static const cloud_numeric_rpc_t cloud_numeric_rpcs[] = {
 		.event = CLOUD_EVENT_OPEN,
 	},
 };
-/* report data paths */
-static const char *cloud_report_paths[REPORT_KIND_MAX] = {
-		"slotOpen",
-		"newCard",
-};
+/* path of batched reports, an object with report paths as keys */
+static const char *cloud_batch_path = "reports";
+/* formatted reports, guarded by cloud_mutex */
+static char cloud_report_buf[CLOUD_BATCH_MAX_LEN + 1];
 /* events generated in this module */
 ESP_EVENT_DEFINE_BASE(CLOUD_EVENT);
 /* settings storage */
@@ -58,8 +69,14 @@ static SemaphoreHandle_t cloud_mutex;
 static golioth_client_t cloud_client = NULL;
 /* application event loop */
 static esp_event_loop_handle_t cloud_event_loop;
+/* next upload retry backoff [ms] */
+static uint32_t cloud_retry_backoff = CONFIG_CLOUD_RETRY_MIN;
+/* upload retry counters */
+static cloud_retry_stats_t cloud_retry_stats;
+/* full acl path observed, backend without acl_delta */
+static bool cloud_acl_observed;
 
-/* call once, starts cloud service if configured in flash */
+/* call once before other cloud functions, cloud service is started by cloud_start */
 void cloud_init(esp_event_loop_handle_t event_loop)
 {
 	cloud_mutex = xSemaphoreCreateMutex();
@@ -68,6 +85,13 @@ void cloud_init(esp_event_loop_handle_t event_loop)
 	ESP_ERROR_CHECK(cloud_event_group == NULL ? ESP_ERR_NO_MEM : ESP_OK);
 	ESP_ERROR_CHECK(nvs_open(cloud_tag, NVS_READWRITE, &cloud_nvs_handle));
 	cloud_event_loop = event_loop;
+	/* link changes cut upload retry backoff short */
+	ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, cloud_ip_event_cb, NULL, NULL));
+}
+
+/* starts cloud service if configured in flash, network stack must be initialised */
+void cloud_start(void)
+{
 	cloud_join(CONFIG_PRIMARY_HARDWARE_ID, CONFIG_DEVICE_ID);
 }
 
@@ -173,30 +197,97 @@ void cloud_log(const char *tag, const char *format, ...)
 	xSemaphoreGive(cloud_mutex);
 }
 
-/* uploads event report to cloud, blocks until completion */
-void cloud_report(report_data_t *report)
+/*
+starts uploading event reports, req callback is called with the result, returns false if not started
+req is kept by caller, nothing is allocated per upload, so uploads dropped by the cloud library leak nothing
+*/
+bool cloud_report_async(report_data_t *reports, size_t count, cloud_report_req_t *req)
 {
 	golioth_status_t ret;
 
-	while(true)
+	if(count == 1 && reports->kind >= REPORT_KIND_MAX) /* nothing to upload */
 	{
-		if(!golioth_client_is_connected(cloud_client)) /* can be called with NULL */
-		{
-			/* block and wait for connection */
-			xEventGroupWaitBits(cloud_event_group, CLOUD_EV_CONNECT_BIT, pdTRUE, pdFALSE, portMAX_DELAY);
-		}
-		xSemaphoreTake(cloud_mutex, portMAX_DELAY);
-		ret = cloud_report_exec(report);
-		xSemaphoreGive(cloud_mutex);
-		if(ret != GOLIOTH_OK) /* try again */
-		{
-			vTaskDelay(pdMS_TO_TICKS(1000*CONFIG_CLOUD_RETRY_TIME));
-		}
-		else /* done */
-		{
-			break;
-		}
+		ESP_LOGW(cloud_tag, "Skipped unsupported report kind %u", (uint32_t)reports->kind);
+		req->cb(true, req->arg);
+		return(true);
+	}
+	if(!golioth_client_is_connected(cloud_client)) /* can be called with NULL */
+		return(false);
+	xSemaphoreTake(cloud_mutex, portMAX_DELAY);
+	if(count == 1)
+		ret = cloud_report_exec(reports, req);
+	else
+		ret = cloud_report_batch_exec(reports, count, req);
+	xSemaphoreGive(cloud_mutex);
+	return(ret == GOLIOTH_OK); /* callback will not be called if not started */
+}
+
+/*
+blocks after a failed upload until the next attempt can be made
+waits a random time between half and full backoff, backoff doubles after every
+failure up to CONFIG_CLOUD_RETRY_MAX, regaining link resets it and ends the wait
+without connection it blocks until connected or woken by cloud_report_wake
+*/
+void cloud_report_wait(void)
+{
+	uint32_t backoff;
+	uint32_t wait;
+	int64_t start;
+
+	start = esp_timer_get_time();
+	backoff = cloud_retry_backoff;
+	cloud_retry_backoff = backoff < CONFIG_CLOUD_RETRY_MAX / 2 ? 2 * backoff : CONFIG_CLOUD_RETRY_MAX;
+	wait = backoff / 2 + esp_random() % (backoff / 2 + 1);
+	ESP_LOGD(cloud_tag, "Retrying upload in %u ms", wait);
+	if(xEventGroupWaitBits(cloud_event_group, CLOUD_EV_RETRY_BIT, pdTRUE, pdFALSE, pdMS_TO_TICKS(wait)) & CLOUD_EV_RETRY_BIT)
+	{
+		cloud_retry_backoff = CONFIG_CLOUD_RETRY_MIN;
+	}
+	if(!golioth_client_is_connected(cloud_client)) /* can be called with NULL */
+	{
+		/* block and wait for connection */
+		xEventGroupWaitBits(cloud_event_group, CLOUD_EV_CONNECT_BIT | CLOUD_EV_WAKE_BIT, pdTRUE, pdFALSE, portMAX_DELAY);
+	}
+	cloud_retry_stats.retries++;
+	cloud_retry_stats.wait_ms += (esp_timer_get_time() - start) / 1000;
+}
+
+/* ends wait for connection of cloud_report_wait, backoff is kept */
+void cloud_report_wake(void)
+{
+	xEventGroupSetBits(cloud_event_group, CLOUD_EV_WAKE_BIT);
+}
+
+/* skips remaining upload retry wait and backoff */
+void cloud_retry_reset(void)
+{
+	cloud_retry_stats.resets++;
+	xEventGroupSetBits(cloud_event_group, CLOUD_EV_RETRY_BIT);
+}
+
+/* copies upload retry counters */
+void cloud_get_retry_stats(cloud_retry_stats_t *stats)
+{
+	*stats = cloud_retry_stats;
+}
+
+/* upload acknowledged or failed */
+static void cloud_report_done_cb(golioth_client_t client, const golioth_response_t *response, const char *path, void *arg)
+{
+	cloud_report_req_t *req = arg;
+	(void)client;
+	(void)path;
+
+	if(response->status != GOLIOTH_OK)
+	{
+		ESP_LOGW(cloud_tag, "Report upload to %s failed: %d", path, response->status);
+	}
+	else /* link works, earlier resets are stale */
+	{
+		cloud_retry_backoff = CONFIG_CLOUD_RETRY_MIN;
+		xEventGroupClearBits(cloud_event_group, CLOUD_EV_RETRY_BIT);
 	}
+	req->cb(response->status == GOLIOTH_OK, req->arg);
 }
 
 /* connect/disconnect events */
@@ -211,6 +302,7 @@ static void cloud_client_cb(golioth_client_t client, golioth_client_event_t even
 		ESP_LOGI(cloud_tag, "Connected");
 		ESP_ERROR_CHECK(esp_event_post_to(cloud_event_loop, CLOUD_EVENT, CLOUD_EVENT_CONNECTED, NULL, 0, portMAX_DELAY));
 		xEventGroupSetBits(cloud_event_group, CLOUD_EV_CONNECT_BIT);
+		cloud_retry_reset();
 		/* update data from LightDB state on connection or if data changes */
 		cloud_update_acl(client);
 		break;
@@ -221,6 +313,17 @@ static void cloud_client_cb(golioth_client_t client, golioth_client_event_t even
 	}
 }
 
+/* station got IP address */
+static void cloud_ip_event_cb(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+	(void)event_handler_arg;
+	(void)event_base;
+	(void)event_id;
+	(void)event_data;
+
+	cloud_retry_reset();
+}
+
 /* common parser for RPCs with a single numeric parameter and no return data */
 static golioth_rpc_status_t cloud_numeric_cb(const char* method, const cJSON* params, uint8_t* detail, size_t detail_size, void* callback_arg)
 {
@@ -254,49 +357,150 @@ static golioth_rpc_status_t cloud_numeric_cb(const char* method, const cJSON* pa
 }
 
 /* formats and uploads report to cloud */
-static golioth_status_t cloud_report_exec(report_data_t *report)
+static golioth_status_t cloud_report_exec(report_data_t *report, cloud_report_req_t *req)
 {
-	char *buf;
-	golioth_status_t ret;
 	size_t len;
 
-	switch(report->kind)
-	{
-	case REPORT_KIND_SLOT_OPEN:
-		len = snprintf(NULL, 0, CLOUD_FORM_SLOT_OPEN(report));
-		buf = malloc(len + 1);
-		sprintf(buf, CLOUD_FORM_SLOT_OPEN(report));
-		ESP_LOGD(cloud_tag, "Button event %d, %llu", report->kind, (uint64_t)(report->when));
-		break;
-	case REPORT_KIND_NEW_CARD:
-		len = snprintf(NULL, 0, CLOUD_FORM_NEW_CARD(report));
-		buf = malloc(len + 1);
-		sprintf(buf, CLOUD_FORM_NEW_CARD(report));
-		ESP_LOGD(cloud_tag, "Button event %d, %llu", report->kind, (uint64_t)(report->when));
-		break;
-	default:
-		ESP_LOGW(cloud_tag, "Skipped unsupported report kind %u", (uint32_t)report->kind);
-		return(GOLIOTH_OK);
-	}
-	ESP_LOGD(cloud_tag, "Path: %s, report: %s", cloud_report_paths[report->kind], buf);
-	ret = golioth_lightdb_stream_set_string_sync(cloud_client, cloud_report_paths[report->kind], buf, len, GOLIOTH_WAIT_FOREVER); /* waits for time specified in the Golioth configuration */
-	free(buf);
-	return(ret);
+	if((uint32_t)report->kind >= REPORT_KIND_MAX) /* filtered out by caller */
+		return(GOLIOTH_ERR_NULL);
+	len = cloud_format_report(cloud_report_buf, report) - cloud_report_buf;
+	cloud_report_buf[len] = '\0';
+	ESP_LOGD(cloud_tag, "Path: %s, report: %s", cloud_format_path(report->kind), cloud_report_buf);
+	return(golioth_lightdb_stream_set_string_async(cloud_client, cloud_format_path(report->kind), cloud_report_buf, len, cloud_report_done_cb, req)); /* payload is copied */
 }
 
+/* formats and uploads reports as {"slotOpen": ["..."], "newCard": ["..."]} in one request */
+static golioth_status_t cloud_report_batch_exec(report_data_t *reports, size_t count, cloud_report_req_t *req)
+{
+	size_t len;
+
+	if(count > REPORT_BATCH_MAX)
+		return(GOLIOTH_ERR_MEM_ALLOC);
+	len = cloud_format_batch(cloud_report_buf, reports, count);
+	ESP_LOGD(cloud_tag, "Path: %s, %u reports: %s", cloud_batch_path, count, cloud_report_buf);
+	return(golioth_lightdb_stream_set_json_async(cloud_client, cloud_batch_path, cloud_report_buf, len, cloud_report_done_cb, req)); /* payload is copied */
+}
+
+/* follows acl changes, full acl is downloaded only if generations do not match */
 void cloud_update_acl(golioth_client_t client)
 {
-	golioth_status_t ret = golioth_lightdb_observe_async(client, "acl", (void*) cloud_parse_acl_cb, NULL);
+	/* let the backend know which acl document versions can be sent */
+	if (golioth_lightdb_set_int_async(client, "acl_ver", ACL_CODEC_VERSION, NULL, NULL) != GOLIOTH_OK)
+		ESP_LOGW(cloud_tag, "Could not set acl_ver");
+	golioth_status_t ret = golioth_lightdb_observe_async(client, "acl_delta", (void*) cloud_parse_acl_delta_cb, NULL);
 	if (ret != GOLIOTH_OK)
 	{
-		ESP_LOGE(cloud_tag, "Could not observe acl path");
+		ESP_LOGE(cloud_tag, "Could not observe acl_delta path");
 		return;
 	}
-	ESP_LOGI(cloud_tag, "Path acl added to LightDB observe");
+	ESP_LOGI(cloud_tag, "Path acl_delta added to LightDB observe");
 }
 
+/* parses {"from": generation, "to": generation, "add": [...], "chg": [...], "del": [...]} */
+static void cloud_parse_acl_delta_cb(golioth_client_t client, const golioth_response_t *response, const char *path, const char *payload, size_t payload_size, void *arg)
+{
+	cJSON *delta;
+	cJSON *from;
+	cJSON *to;
+	uint32_t generation;
+	bool applied;
+	(void)path;
+	(void)arg;
+
+	if (response->status != GOLIOTH_OK)
+	{
+		ESP_LOGE(cloud_tag, "Error while updating acl delta");
+		return;
+	}
+	ESP_LOGD(cloud_tag, "acl delta JSON payload: %.*s", payload_size, payload);
+	delta = cJSON_ParseWithLength(payload, payload_size);
+	if (!payload_size || cJSON_IsNull(delta))
+	{
+		/* backend does not publish changes, follow the full acl */
+		cJSON_Delete(delta);
+		if (cloud_acl_observed)
+			return;
+		ESP_LOGI(cloud_tag, "No acl delta, observing acl path");
+		if (golioth_lightdb_observe_async(client, "acl", (void*) cloud_parse_acl_cb, NULL) != GOLIOTH_OK)
+			ESP_LOGE(cloud_tag, "Could not observe acl path");
+		else
+			cloud_acl_observed = true;
+		return;
+	}
+	from = cJSON_GetObjectItem(delta, "from");
+	to = cJSON_GetObjectItem(delta, "to");
+	if (!cJSON_IsNumber(from) || !cJSON_IsNumber(to))
+	{
+		ESP_LOGW(cloud_tag, "Invalid acl delta ignored");
+		cJSON_Delete(delta);
+		return;
+	}
+
+	generation = access_get_acl_generation();
+	if ((uint32_t)to->valuedouble == generation)
+	{
+		ESP_LOGI(cloud_tag, "acl generation %u up to date", generation);
+		cJSON_Delete(delta);
+		return;
+	}
+	if ((uint32_t)from->valuedouble == generation)
+	{
+		ESP_LOGI(cloud_tag, "Applying acl delta %u -> %u", generation, (uint32_t)to->valuedouble);
+		applied = cloud_apply_acl_ops(cJSON_GetObjectItem(delta, "add"), false) &&
+				cloud_apply_acl_ops(cJSON_GetObjectItem(delta, "chg"), false) &&
+				cloud_apply_acl_ops(cJSON_GetObjectItem(delta, "del"), true) &&
+				access_set_acl_delta_in_nvs((uint32_t)to->valuedouble) == ESP_OK;
+		if (applied)
+		{
+			cJSON_Delete(delta);
+			return;
+		}
+		ESP_LOGW(cloud_tag, "Could not apply acl delta");
+		access_get_acl_from_nvs(); /* drop unsaved changes */
+	}
+	cJSON_Delete(delta);
+
+	/* generations do not match, download full acl */
+	ESP_LOGI(cloud_tag, "acl generation %u outdated, downloading acl", generation);
+	if (golioth_lightdb_get_async(client, "acl", (void*) cloud_parse_acl_cb, NULL) != GOLIOTH_OK)
+		ESP_LOGE(cloud_tag, "Could not get acl path");
+}
+
+/* applies array of "hex_card_id:privilege_to_slots" or "hex_card_id" entries */
+static bool cloud_apply_acl_ops(cJSON *ops, bool remove)
+{
+	cJSON *op;
+	uint64_t card_id;
+	uint8_t privilage_to_slots;
+
+	if (!ops)
+		return true;
+	if (!cJSON_IsArray(ops))
+		return false;
+	cJSON_ArrayForEach(op, ops)
+	{
+		if (!cJSON_IsString(op) || !acl_codec_parse_entry(op->valuestring, strlen(op->valuestring), &card_id, &privilage_to_slots))
+			return false;
+		if ((remove ? access_remove_card(card_id) : access_update_card(card_id, privilage_to_slots)) != ESP_OK)
+			return false;
+	}
+	return true;
+}
+
+/* streams parsed entries into the new acl */
+static bool cloud_save_acl_entry_cb(uint64_t card_id, uint8_t privilage_to_slots, void *arg)
+{
+	(void)arg;
+
+	ESP_LOGD(cloud_tag, "acl parsed to int: %llu, %d", card_id, privilage_to_slots);
+	access_save_card_id_in_ram(card_id, privilage_to_slots);
+	return true;
+}
+
+/* parses legacy array, {"gen": generation, "acl": [...]} or {"v": 2, "gen": generation, "bin": "..."} without building a JSON tree */
 static void cloud_parse_acl_cb(golioth_client_t client, const golioth_response_t *response, const char *path, const char *payload, size_t payload_size, void *arg)
 {
+	acl_codec_doc_t doc;
 	(void)arg;
 
 	if (response->status != GOLIOTH_OK)
@@ -305,33 +509,28 @@ static void cloud_parse_acl_cb(golioth_client_t client, const golioth_response_t
 		return;
 	}
 
-	ESP_LOGD(cloud_tag, "acl JSON payload: %s", payload);
-   	cJSON *acl = cJSON_Parse(payload);
-    if (acl != NULL && cJSON_IsArray(acl)) 
+	ESP_LOGD(cloud_tag, "acl JSON payload: %.*s", payload_size, payload);
+	/* validate and read generation before touching the stored acl */
+	if (!acl_codec_parse_json(payload, payload_size, &doc, NULL, NULL) || !doc.has_acl)
 	{
-		access_fill_with_zeros_acl();
-        uint8_t i, acl_counter = cJSON_GetArraySize(acl);
-		ESP_LOGD(cloud_tag, "acl size: %d", acl_counter);
-        for (i = 0; i < acl_counter; i++) 
-		{
-            cJSON *acl_item = cJSON_GetArrayItem(acl, i);
-            if (acl_item != NULL && cJSON_IsString(acl_item)) 
-			{
-                char *acl_item_str = cJSON_GetStringValue(acl_item);
-                ESP_LOGD(cloud_tag, "acl entry: %s", acl_item_str);
-				/* parsing "hex_card_id:privilege_to_slots" format */
-				char *hex_card_id_str = strtok(acl_item_str, ":");
-				char *hex_privilage_to_slots_str = strtok(NULL, ":");
-				ESP_LOGD(cloud_tag, "acl parsed to str: %s, %s", hex_card_id_str, hex_privilage_to_slots_str);
-				uint64_t card_id = strtoll(hex_card_id_str, NULL, 16);
-				uint8_t privilage_to_slots = strtol(hex_privilage_to_slots_str, NULL, 16);
-				ESP_LOGD(cloud_tag, "acl parsed to int: %llu, %d", card_id, privilage_to_slots);
-				/* save card_id and privilage_to_slots */	
-				access_save_card_id_in_ram(card_id, privilage_to_slots);
-            }
-        }
-    }
-	access_set_acl_in_nvs();
-    cJSON_Delete(acl);
-    return; 
-}
\ No newline at end of file
+		if (doc.version > ACL_CODEC_VERSION)
+			ESP_LOGE(cloud_tag, "Unsupported acl version %u", doc.version);
+		else
+			ESP_LOGE(cloud_tag, "Invalid acl document");
+		return;
+	}
+	if (doc.has_generation && doc.generation && doc.generation == access_get_acl_generation())
+	{
+		ESP_LOGI(cloud_tag, "acl generation %u up to date", doc.generation);
+		return;
+	}
+	ESP_LOGD(cloud_tag, "acl size: %u, skipped: %u", doc.entries, doc.skipped);
+	access_fill_with_zeros_acl();
+	if (!acl_codec_parse_json(payload, payload_size, &doc, cloud_save_acl_entry_cb, NULL))
+	{
+		ESP_LOGE(cloud_tag, "Error while parsing acl");
+		access_discard_acl();
+		return;
+	}
+	access_set_acl_in_nvs(doc.generation);
+}
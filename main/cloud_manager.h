@@ -25,12 +25,35 @@ typedef struct
 	uint8_t code_len;
 } cloud_wiegand_data_t;
 
+/* upload retry counters */
+typedef struct
+{
+	uint32_t retries;
+	uint32_t resets;
+	uint64_t wait_ms;
+} cloud_retry_stats_t;
+
+/* report upload result */
+typedef void (*cloud_report_cb_t)(bool success, void *arg);
+
+/* report upload, owned by caller, the cloud library may drop it without calling back */
+typedef struct
+{
+	cloud_report_cb_t cb;
+	void *arg;
+} cloud_report_req_t;
+
 ESP_EVENT_DECLARE_BASE(CLOUD_EVENT);
 
 void cloud_init(esp_event_loop_handle_t event_loop);
+void cloud_start(void);
 void cloud_join(char *id, char *psk);
 void cloud_leave(void);
 void cloud_log(const char *tag, const char *format, ...);
-void cloud_report(report_data_t *report);
+bool cloud_report_async(report_data_t *reports, size_t count, cloud_report_req_t *req);
+void cloud_report_wait(void);
+void cloud_report_wake(void);
+void cloud_retry_reset(void);
+void cloud_get_retry_stats(cloud_retry_stats_t *stats);
 
 #endif /* MAIN_CLOUD_MANAGER_H_ */
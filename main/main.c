@@ -5,6 +5,7 @@
 #include "freertos/task.h"
 #include "freertos/timers.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "task_prio.h"
@@ -19,14 +20,86 @@
 
 #define SERVO_OPEN_PERIOD pdMS_TO_TICKS(3000)
 
+/* boot stages, timestamped once */
+typedef enum
+{
+	APP_BOOT_MAIN,
+	APP_BOOT_NVS,
+	APP_BOOT_BOARD,
+	APP_BOOT_ACL,
+	APP_BOOT_READY, /* readers accept cards */
+	APP_BOOT_WIFI,
+	APP_BOOT_CLOUD,
+	APP_BOOT_CONNECTED,
+	APP_BOOT_FIRST_CARD,
+	APP_BOOT_FIRST_UNLOCK,
+	APP_BOOT_MAX
+} app_boot_stage_t;
+
 static const char *app_tag = "app";
+static const char *app_boot_names[APP_BOOT_MAX] = {
+	[APP_BOOT_MAIN] = "main",
+	[APP_BOOT_NVS] = "nvs",
+	[APP_BOOT_BOARD] = "board",
+	[APP_BOOT_ACL] = "acl",
+	[APP_BOOT_READY] = "ready",
+	[APP_BOOT_WIFI] = "wifi",
+	[APP_BOOT_CLOUD] = "cloud",
+	[APP_BOOT_CONNECTED] = "connected",
+	[APP_BOOT_FIRST_CARD] = "first card",
+	[APP_BOOT_FIRST_UNLOCK] = "first unlock",
+};
 
+static void app_net_task(void *arg);
+static void app_boot_mark(app_boot_stage_t stage);
+static void app_boot_report(void);
+static void app_reader_report(void);
+static void app_upload_report(void);
 static void app_event_cb(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
 static void servo_close_cb(TimerHandle_t timer);
 static void remove_privilages_cb(TimerHandle_t timer);
 
+#if defined(CONFIG_BOARD_READER_2) && CONFIG_BOARD_READER_2_EN_GPIO >= 0 && CONFIG_BOARD_READER_2_EN_GPIO == CONFIG_BOARD_READER_EN_GPIO
+#error "Readers must not share the power control GPIO, a power cycle of one would restart both"
+#endif
+
+/* card readers */
+static const board_reader_config_t app_readers[] = {
+	{
+		.id = 0,
+		.addr = 0,
+		.uart = UART_NUM_1,
+		.tx_gpio = CONFIG_BOARD_READER_TXD_GPIO,
+		.rx_gpio = CONFIG_BOARD_READER_RXD_GPIO,
+		.en_gpio = CONFIG_BOARD_READER_EN_GPIO,
+		.trg_gpio = CONFIG_BOARD_READER_TRG_GPIO,
+	},
+#ifdef CONFIG_BOARD_READER_2
+	{
+		.id = 1,
+		.addr = 0,
+		.uart = UART_NUM_2,
+		.tx_gpio = CONFIG_BOARD_READER_2_TXD_GPIO,
+		.rx_gpio = CONFIG_BOARD_READER_2_RXD_GPIO,
+		.en_gpio = CONFIG_BOARD_READER_2_EN_GPIO,
+		.trg_gpio = CONFIG_BOARD_READER_2_TRG_GPIO,
+	},
+#endif
+};
+#define APP_READERS (sizeof(app_readers) / sizeof(app_readers[0]))
+/* started readers, NULL until started */
+static board_reader_t app_reader_handles[APP_READERS];
+
 const esp_partition_t *app_fring_partition;
+const esp_partition_t *app_fring_hi_partition;
+const esp_partition_t *app_acl_partition;
 static esp_event_loop_handle_t app_event_loop;
+/* time of each boot stage since power on [us], 0 if not reached */
+static int64_t app_boot_times[APP_BOOT_MAX];
+/* boot stages are sent to cloud once connected */
+static bool app_boot_reported;
+/* guards boot times and reported flag, stages are reached by several tasks */
+static portMUX_TYPE app_boot_lock = portMUX_INITIALIZER_UNLOCKED;
 
 TimerHandle_t remove_privilages_timer;
 static uint8_t privilege_to_slots = 0x00;
@@ -42,9 +115,15 @@ typedef enum
 	SLOT_MAX
 } main_slots_t;
 
+/*
+staged start up, card checks do not wait for network
+board comes up before LEDs, ACL, readers and servos before network and cloud started in parallel task
+*/
 void app_main(void)
 {
 	esp_err_t ret;
+	BaseType_t task_ret;
+	size_t i;
 
 	/* main application event loop */
 	const esp_event_loop_args_t loop_args = {
@@ -54,6 +133,7 @@ void app_main(void)
 		.task_stack_size = 4096 + configMINIMAL_STACK_SIZE,
 		.task_core_id = tskNO_AFFINITY
 	};
+	app_boot_mark(APP_BOOT_MAIN);
 	/* application events */
 	ESP_ERROR_CHECK(esp_event_loop_create(&loop_args, &app_event_loop));
 	ESP_ERROR_CHECK(esp_event_handler_instance_register_with(app_event_loop, ESP_EVENT_ANY_BASE, ESP_EVENT_ANY_ID, app_event_cb, NULL, NULL));
@@ -70,26 +150,125 @@ void app_main(void)
 		ret = nvs_flash_init();
 	}
 	ESP_ERROR_CHECK(ret);
+	app_boot_mark(APP_BOOT_NVS);
+	board_init(app_event_loop); /* all low level inits, LED channels are used by led manager task */
+	app_boot_mark(APP_BOOT_BOARD);
+	led_start(); /* set up led manager main task, network events notify it */
+	cloud_init(app_event_loop); /* cloud state only, service is started by network task */
+	/* connects to network and cloud in parallel */
+	task_ret = xTaskCreate(app_net_task, "app_net", 4096 + configMINIMAL_STACK_SIZE, NULL, TP_NET, NULL);
+	ESP_ERROR_CHECK(task_ret != pdPASS ? ESP_ERR_NO_MEM : ESP_OK);
 	/* storage for produced reports */
 	app_fring_partition = esp_partition_find_first(0x40, 0x00, "flash_ring");
-	board_init(app_event_loop); /* all low level inits */
-	led_start(); /* set up led manager main task */
-	wifi_init(); /* connects to network if configured in the NVS */
-	report_start(app_fring_partition); /* saves and uploads reports */
-	board_reader_start(app_event_loop, TP_READER); /* reads QR codes */
-	cloud_init(app_event_loop); /* connects to cloud if configured in the NVS */
-	access_init(); /* all nvs inits */ 
+	/* storage for security events uploaded first, missing on devices with older partition table */
+	app_fring_hi_partition = esp_partition_find_first(0x40, 0x02, "flash_ring_hi");
+	/* storage for access control list */
+	app_acl_partition = esp_partition_find_first(0x40, 0x01, "acl");
+	access_init(app_acl_partition); /* acl is loaded before first card */
+	app_boot_mark(APP_BOOT_ACL);
 	
 	/* create timer which wait 3 secs and close servos */
 	servo_close_timer = xTimerCreate("servo", SERVO_OPEN_PERIOD, pdFALSE, NULL, servo_close_cb);
 	ESP_ERROR_CHECK(servo_close_timer == NULL ? ESP_ERR_NO_MEM : ESP_OK);
 	
-	/* idle state waiting for card scanning  */
-	led_task_notify(LED_NOTIFY_IDLE);
-	
 	/* create timer to revoke privilages to slots */	
 	remove_privilages_timer = xTimerCreate("remove_privilages", LED_SLOT_SEL_PERIOD, pdFALSE, NULL, remove_privilages_cb);
-	ESP_ERROR_CHECK(remove_privilages_cb == NULL ? ESP_ERR_NO_MEM : ESP_OK);
+	ESP_ERROR_CHECK(remove_privilages_timer == NULL ? ESP_ERR_NO_MEM : ESP_OK);
+	report_start(app_fring_partition, app_fring_hi_partition); /* saves and uploads reports */
+	/* reads card ids, everything used by card events is set up */
+	for(i = 0; i < APP_READERS; i++)
+		app_reader_handles[i] = board_reader_start(&app_readers[i], app_event_loop, TP_READER);
+	app_boot_mark(APP_BOOT_READY);
+	
+	/* idle state waiting for card scanning  */
+	led_task_notify(LED_NOTIFY_IDLE);
+}
+
+/* connects to network and cloud if configured in the NVS, then ends */
+static void app_net_task(void *arg)
+{
+	(void)arg;
+
+	wifi_init();
+	app_boot_mark(APP_BOOT_WIFI);
+	cloud_start();
+	app_boot_mark(APP_BOOT_CLOUD);
+	vTaskDelete(NULL);
+}
+
+/* timestamps boot stage reached first time */
+static void app_boot_mark(app_boot_stage_t stage)
+{
+	int64_t now = esp_timer_get_time();
+	bool first;
+	bool reported;
+
+	taskENTER_CRITICAL(&app_boot_lock);
+	first = !app_boot_times[stage];
+	if(first)
+		app_boot_times[stage] = now;
+	reported = app_boot_reported;
+	taskEXIT_CRITICAL(&app_boot_lock);
+	if(!first)
+		return;
+	ESP_LOGI(app_tag, "Boot %s %lld ms", app_boot_names[stage], now / 1000);
+	if(reported) /* later stages are sent when reached */
+		cloud_log(app_tag, "Boot %s %lld ms", app_boot_names[stage], now / 1000);
+}
+
+/* sends boot stages reached so far to cloud, once per boot */
+static void app_boot_report(void)
+{
+	int64_t times[APP_BOOT_MAX];
+	size_t i;
+
+	/* stages reached after this are sent by app_boot_mark() */
+	taskENTER_CRITICAL(&app_boot_lock);
+	if(app_boot_reported)
+	{
+		taskEXIT_CRITICAL(&app_boot_lock);
+		return;
+	}
+	app_boot_reported = true;
+	memcpy(times, app_boot_times, sizeof(times));
+	taskEXIT_CRITICAL(&app_boot_lock);
+	for(i = 0; i < APP_BOOT_MAX; i++)
+	{
+		if(times[i])
+			cloud_log(app_tag, "Boot %s %lld ms", app_boot_names[i], times[i] / 1000);
+	}
+}
+
+/* sends reader counters since boot to cloud, repeated cards are suppressed by the reader task */
+static void app_reader_report(void)
+{
+	board_reader_stats_t stats;
+	size_t i;
+
+	for(i = 0; i < APP_READERS; i++)
+	{
+		if(!app_reader_handles[i])
+			continue;
+		board_reader_get_stats(app_reader_handles[i], &stats);
+		cloud_log(app_tag, "Reader %u cards %u, suppressed %u, frames %u, incomplete %u, resyncs %u, overflows %u, polls %u, poll timeouts %u, power cycles %u",
+				app_readers[i].id, stats.cards, stats.suppressed, stats.frames, stats.incomplete_frames, stats.resyncs, stats.overflows,
+				stats.polls, stats.poll_timeouts, stats.power_cycles);
+	}
+}
+
+/* sends report counters of each upload lane to cloud */
+static void app_upload_report(void)
+{
+	report_stats_t stats;
+	report_lane_t lane;
+
+	report_get_stats(&stats);
+	for(lane = 0; lane < REPORT_LANE_MAX; lane++)
+	{
+		cloud_log(app_tag, "Reports lane %d stored %u, uploaded %u, backlog %u, compacted %u, ring %u%% used, oldest %u s",
+				lane, stats.lanes[lane].stored, stats.lanes[lane].uploaded, stats.lanes[lane].backlog, stats.lanes[lane].compacted,
+				stats.lanes[lane].fill, stats.lanes[lane].age);
+	}
 }
 
 static void servo_close_cb(TimerHandle_t timer)
@@ -128,9 +307,10 @@ static void app_event_cb(void *event_handler_arg, esp_event_base_t event_base, i
 			case BOARD_EVENT_NEW_CARD: /* process code */
 			{
 				/* recived valid CTU card ID */
-				uint64_t *event_card_id = event_data;
-				received_card_id = *event_card_id;
-				ESP_LOGD(app_tag, "Received card ID: %llu", received_card_id);
+				board_card_event_t *card_event = event_data;
+				app_boot_mark(APP_BOOT_FIRST_CARD);
+				received_card_id = card_event->card_id;
+				ESP_LOGD(app_tag, "Reader %u received card ID: %llu", card_event->reader_id, received_card_id);
 
 				if (access_find_card_id_in_nvs(received_card_id, &privilege_to_slots))
 				{	
@@ -154,7 +334,6 @@ static void app_event_cb(void *event_handler_arg, esp_event_base_t event_base, i
 					report_data.card_id = received_card_id;
 					report_add(&report_data);
 				}
-				access_get_acl_from_nvs();
 				break;
 			}
 			case BOARD_EVENT_BUTTON:
@@ -189,6 +368,7 @@ static void app_event_cb(void *event_handler_arg, esp_event_base_t event_base, i
 					report_data.card_id = received_card_id;
                 	report_data.slot_id = servo + 1;
 					board_servo_set_angle(servo, CONFIG_UI_SERVO_OPEN_ANGLE);
+					app_boot_mark(APP_BOOT_FIRST_UNLOCK);
 					report_data.kind = REPORT_KIND_SLOT_OPEN;
 					report_add(&report_data);
 				}
@@ -221,11 +401,15 @@ static void app_event_cb(void *event_handler_arg, esp_event_base_t event_base, i
 		switch(event_id)
 		{
 			case CLOUD_EVENT_CONNECTED:
+				app_boot_mark(APP_BOOT_CONNECTED);
+				app_boot_report();
 				led_task_notify(LED_NOTIFY_IDLE);
 				gettimeofday(&sys_time, NULL);
 				time_str = ctime(&sys_time.tv_sec);
 				time_str[strlen(time_str) - 1] = 0;
 				cloud_log(app_tag, "HWt " BOARD_HW_INFO " %s", time_str);
+				app_reader_report();
+				app_upload_report();
 				if(app_wifi_connected && reader_info)
 				{
 					cloud_log(app_tag, reader_info);
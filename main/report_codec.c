@@ -0,0 +1,210 @@
+#include <string.h>
+#include "report_codec.h"
+
+/*
+
+REPORT FLASH ENTRY FORMAT
+
+version 1
+[magic][version][record]...
+
+record
+[header][time varint][card id 5 or 8 bytes][slot if slot open][count varint if summary][crc8]
+
+Header holds the report kind in the low nibble, REPORT_CODEC_LONG_ID if
+the card id does not fit 5 bytes and REPORT_CODEC_SUMMARY if the record
+summarises count reports. Time of the first record in an entry is
+the unsigned varint of seconds, following records store the zigzag varint
+difference from the previous record. Card id is little endian. CRC-8 (poly
+0x07) covers the whole record, decoding stops at the first bad record since
+following record boundaries cannot be trusted.
+
+Entries written by older firmware hold raw report_data_t structs, they never
+start with the magic byte since report kinds are small.
+
+*/
+
+#define REPORT_CODEC_MAGIC 0xA5
+#define REPORT_CODEC_KIND_MASK 0x0F
+#define REPORT_CODEC_LONG_ID 0x10
+#define REPORT_CODEC_SUMMARY 0x20
+#define REPORT_CODEC_SHORT_ID_BYTES 5
+#define REPORT_CODEC_LONG_ID_BYTES 8
+
+static uint8_t report_codec_crc8(const uint8_t *buf, size_t len)
+{
+	uint8_t crc = 0;
+	uint8_t i;
+
+	while(len--)
+	{
+		crc ^= *buf++;
+		for(i = 0; i < 8; i++)
+			crc = crc & 0x80 ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+	}
+	return(crc);
+}
+
+static size_t report_codec_put_varint(uint8_t *buf, uint64_t value)
+{
+	size_t len = 0;
+
+	while(value >= 0x80)
+	{
+		buf[len++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	buf[len++] = (uint8_t)value;
+	return(len);
+}
+
+/* returns varint length, 0 if truncated or too long */
+static size_t report_codec_get_varint(const uint8_t *buf, size_t len, uint64_t *value)
+{
+	size_t i;
+
+	*value = 0;
+	for(i = 0; i < len && i < 10; i++)
+	{
+		*value |= (uint64_t)(buf[i] & 0x7F) << (7 * i);
+		if(!(buf[i] & 0x80))
+			return(i + 1);
+	}
+	return(0);
+}
+
+/* encodes reports as one flash entry, returns entry size or 0 if it does not fit */
+size_t report_codec_encode(uint8_t *buf, size_t size, const report_data_t *reports, size_t count)
+{
+	uint8_t record[REPORT_CODEC_MAX_RECORD];
+	size_t pos = 0;
+	size_t len;
+	size_t id_bytes;
+	size_t i;
+	size_t j;
+	int64_t delta;
+	uint64_t card_id;
+
+	if(size < 2)
+		return(0);
+	buf[pos++] = REPORT_CODEC_MAGIC;
+	buf[pos++] = REPORT_CODEC_VERSION;
+	for(i = 0; i < count; i++)
+	{
+		len = 0;
+		card_id = reports[i].card_id;
+		id_bytes = card_id >> (8 * REPORT_CODEC_SHORT_ID_BYTES) ? REPORT_CODEC_LONG_ID_BYTES : REPORT_CODEC_SHORT_ID_BYTES;
+		record[len++] = (reports[i].kind & REPORT_CODEC_KIND_MASK) | (id_bytes == REPORT_CODEC_LONG_ID_BYTES ? REPORT_CODEC_LONG_ID : 0) |
+				(reports[i].summarised ? REPORT_CODEC_SUMMARY : 0);
+		if(!i)
+		{
+			len += report_codec_put_varint(record + len, (uint64_t)reports[i].when);
+		}
+		else
+		{
+			delta = (int64_t)reports[i].when - (int64_t)reports[i - 1].when;
+			len += report_codec_put_varint(record + len, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+		}
+		for(j = 0; j < id_bytes; j++)
+			record[len++] = (uint8_t)(card_id >> (8 * j));
+		if(reports[i].kind == REPORT_KIND_SLOT_OPEN)
+			record[len++] = reports[i].slot_id;
+		if(reports[i].summarised)
+			len += report_codec_put_varint(record + len, reports[i].summarised);
+		record[len] = report_codec_crc8(record, len);
+		len++;
+		if(size - pos < len)
+			return(0);
+		memcpy(buf + pos, record, len);
+		pos += len;
+	}
+	return(pos);
+}
+
+/* decodes flash entry in current or legacy format, returns number of reports, undecodable records are counted in errors */
+size_t report_codec_decode(const uint8_t *buf, size_t len, report_data_t *reports, size_t max, uint32_t *errors)
+{
+	report_data_t *report;
+	size_t count = 0;
+	size_t pos;
+	size_t start;
+	size_t done;
+	size_t id_bytes;
+	size_t j;
+	size_t n;
+	uint64_t value;
+
+	if(len && buf[0] != REPORT_CODEC_MAGIC) /* raw structs from older firmware */
+	{
+		if(len % sizeof(report_data_t))
+		{
+			(*errors)++;
+			return(0);
+		}
+		for(pos = 0; pos < len; pos += sizeof(report_data_t))
+		{
+			if(count < max)
+			{
+				memcpy(&reports[count], buf + pos, sizeof(report_data_t));
+				reports[count].summarised = 0; /* was padding */
+				if((uint32_t)reports[count].kind < REPORT_KIND_MAX)
+				{
+					count++;
+					continue;
+				}
+			}
+			(*errors)++;
+		}
+		return(count);
+	}
+	if(len < 2 || buf[1] != REPORT_CODEC_VERSION) /* unknown version */
+	{
+		(*errors)++;
+		return(0);
+	}
+	pos = 2;
+	done = pos;
+	while(pos < len)
+	{
+		start = pos;
+		if(count >= max)
+			break;
+		report = &reports[count];
+		report->kind = buf[pos] & REPORT_CODEC_KIND_MASK;
+		if((uint32_t)report->kind >= REPORT_KIND_MAX)
+			break;
+		id_bytes = buf[pos] & REPORT_CODEC_LONG_ID ? REPORT_CODEC_LONG_ID_BYTES : REPORT_CODEC_SHORT_ID_BYTES;
+		pos++;
+		n = report_codec_get_varint(buf + pos, len - pos, &value);
+		if(!n)
+			break;
+		pos += n;
+		if(!count)
+			report->when = (time_t)value;
+		else
+			report->when = (time_t)((int64_t)reports[count - 1].when + (int64_t)((value >> 1) ^ (~(value & 1) + 1)));
+		if(len - pos < id_bytes + (report->kind == REPORT_KIND_SLOT_OPEN) + 1)
+			break;
+		report->card_id = 0;
+		for(j = 0; j < id_bytes; j++)
+			report->card_id |= (uint64_t)buf[pos++] << (8 * j);
+		report->slot_id = report->kind == REPORT_KIND_SLOT_OPEN ? buf[pos++] : 0;
+		report->summarised = 0;
+		if(buf[start] & REPORT_CODEC_SUMMARY)
+		{
+			n = report_codec_get_varint(buf + pos, len - pos, &value);
+			if(!n || value > UINT16_MAX || len - pos < n + 1)
+				break;
+			pos += n;
+			report->summarised = (uint16_t)value;
+		}
+		if(report_codec_crc8(buf + start, pos - start) != buf[pos])
+			break;
+		pos++;
+		done = pos;
+		count++;
+	}
+	if(done < len) /* rest of entry cannot be decoded */
+		(*errors)++;
+	return(count);
+}
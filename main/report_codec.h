@@ -0,0 +1,35 @@
+#ifndef MAIN_REPORT_CODEC_H_
+#define MAIN_REPORT_CODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/* flash entry format version written by this firmware */
+#define REPORT_CODEC_VERSION 1
+/* longest encoded record, header, varint time, long card id, slot, varint summary count and CRC */
+#define REPORT_CODEC_MAX_RECORD (1 + 10 + 8 + 1 + 3 + 1)
+/* buffer size for encoding n reports */
+#define REPORT_CODEC_ENTRY_SIZE(n) (2 + (n) * REPORT_CODEC_MAX_RECORD)
+
+/* report content types */
+typedef enum {
+	REPORT_KIND_SLOT_OPEN,
+	REPORT_KIND_NEW_CARD,
+	REPORT_KIND_MAX
+} report_kind_t;
+
+/* report data structure */
+typedef struct
+{
+	report_kind_t kind;
+	time_t when;
+	uint64_t card_id;
+	uint8_t slot_id;
+	uint16_t summarised; /* number of reports merged into this summary, 0 for single report */
+} report_data_t;
+
+size_t report_codec_encode(uint8_t *buf, size_t size, const report_data_t *reports, size_t count);
+size_t report_codec_decode(const uint8_t *buf, size_t len, report_data_t *reports, size_t max, uint32_t *errors);
+
+#endif /* MAIN_REPORT_CODEC_H_ */
@@ -1,33 +1,182 @@
 #include <time.h>
+#include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
 #include "esp_log.h"
+#include "esp_system.h"
 #include "task_prio.h"
 #include "flash_ring.h"
 #include "cloud_manager.h"
 
+#define REPORT_BATCH_LINGER pdMS_TO_TICKS(CONFIG_REPORT_BATCH_LINGER)
+#define REPORT_ACK_TIMEOUT pdMS_TO_TICKS(1000*CONFIG_REPORT_ACK_TIMEOUT)
+/* last flash entry read into window may spill over batch size into further slots */
+#define REPORT_WINDOW_MAX (CONFIG_REPORT_WINDOW + (CONFIG_REPORT_GROUP_SIZE + CONFIG_REPORT_BATCH_SIZE - 2) / CONFIG_REPORT_BATCH_SIZE)
+/* upload callback argument holds window slot index in low bits and round above */
+#define REPORT_SLOT_BITS 6
+#define REPORT_SLOT_MASK ((1 << REPORT_SLOT_BITS) - 1)
+_Static_assert(REPORT_WINDOW_MAX <= (1 << REPORT_SLOT_BITS), "window slot index must fit callback argument");
+
+#ifdef CONFIG_REPORT_COMPACT
+#define REPORT_COMPACT_AGE (3600 * CONFIG_REPORT_COMPACT_AGE)
+#define REPORT_COMPACT_DAY (24 * 3600)
+/* earlier system time means time was not synchronised, report age is unknown */
+#define REPORT_COMPACT_TIME_VALID 1600000000
+/* summaries of window batches and of further stored entries */
+#define REPORT_COMPACT_MAX (CONFIG_REPORT_WINDOW * REPORT_BATCH_MAX + CONFIG_REPORT_COMPACT_SIZE)
+/* age of waiting reports is checked this often */
+#define REPORT_COMPACT_CHECK pdMS_TO_TICKS(10 * 60 * 1000)
+#endif
+
+/* time allowed to store staged reports before restart */
+#define REPORT_SHUTDOWN_FLUSH pdMS_TO_TICKS(2000)
+
+/* largest flash entry, encoded group or raw structs from older firmware */
+#define REPORT_ENTRY_MAX_SIZE (REPORT_CODEC_ENTRY_SIZE(CONFIG_REPORT_GROUP_SIZE) > CONFIG_REPORT_GROUP_SIZE * sizeof(report_data_t) ? \
+		REPORT_CODEC_ENTRY_SIZE(CONFIG_REPORT_GROUP_SIZE) : CONFIG_REPORT_GROUP_SIZE * sizeof(report_data_t))
+
+/* staged report or flush request */
+typedef struct {
+	report_data_t data;
+	uint32_t flush; /* flush request number, 0 for a report */
+} report_staged_t;
+
+/* upload window slot state */
+typedef enum {
+	REPORT_SLOT_IDLE, /* not uploaded or failed */
+	REPORT_SLOT_PENDING,
+	REPORT_SLOT_DONE
+} report_slot_state_t;
+
+/* batch of reports in upload window */
+typedef struct {
+	report_data_t reports[REPORT_BATCH_MAX];
+	size_t count;
+	uint32_t round;
+	report_slot_state_t state;
+	report_lane_t lane; /* flash ring the batch was read from */
+} report_slot_t;
+
 static const char *report_tag = "report";
 
+static void report_writer_task(void *arg);
+static void report_shutdown(void);
+static report_lane_t report_lane(report_kind_t kind);
 static void report_upload_task(void *arg);
+static size_t report_read_window(TickType_t linger);
+static bool report_read_batch(report_slot_t *slot, report_lane_t lane, TickType_t wait, TickType_t linger);
+static size_t report_read_entry(report_slot_t *slot, TickType_t wait);
+static uint32_t report_ring_backlog(const esp_partition_t *partition);
+static void report_split_batch(report_slot_t *slot, report_slot_t *next);
+static void report_release(report_lane_t lane);
+static uint32_t report_fill(report_lane_t lane);
+static bool report_upload_window(size_t slots);
+static void report_confirm_window(size_t slots);
+#ifdef CONFIG_REPORT_COMPACT
+static void report_compact_timer_cb(TimerHandle_t timer);
+static bool report_compact_window(size_t slots);
+static bool report_compactable(size_t slots, report_lane_t lane, time_t now, time_t age);
+static bool report_compact_young(const report_slot_t *slot, time_t now, time_t age);
+static bool report_compact_store(report_lane_t lane, const uint8_t *entry, size_t len, bool *released);
+static void report_compact_lane(size_t slots, report_lane_t lane, time_t now, time_t age);
+static size_t report_compact_merge(report_data_t *summaries, size_t count, const report_data_t *report, time_t now, time_t age);
+#endif
+static void report_upload_done_cb(bool success, void *arg);
 
-/* report data storage */
-static fring_context_t *report_fring_ctx;
+/* report data storage per lane, high lane is NULL without its partition */
+static fring_context_t *report_fring_ctx[REPORT_LANE_MAX];
+/* lane of each report kind */
+static const report_lane_t report_kind_lanes[REPORT_KIND_MAX] = {
+	[REPORT_KIND_SLOT_OPEN] = REPORT_LANE_LOW,
+	[REPORT_KIND_NEW_CARD] = REPORT_LANE_HIGH,
+};
+/* reports waiting to be stored in flash */
+static QueueHandle_t report_staging;
+/* given by writer task after storing reports */
+static SemaphoreHandle_t report_stored;
+/* given by writer task once everything staged before a flush request is stored */
+static SemaphoreHandle_t report_flushed;
+/* number of the last flush request answered */
+static volatile uint32_t report_flushed_seq;
+/* one flush request at a time */
+static SemaphoreHandle_t report_flush_lock;
+/* batches read from storage, confirmed together once all are uploaded */
+static report_slot_t report_window[REPORT_WINDOW_MAX];
+/*
+upload request of each window slot, reused by the next upload of the slot
+a late answer to an earlier upload of the slot is for the same reports, since
+the window is refilled only after every slot was answered or was never started
+*/
+static cloud_report_req_t report_reqs[REPORT_WINDOW_MAX];
+/* upload attempt counter, tells stale callbacks apart */
+static uint32_t report_round;
+/* guards window slot states */
+static portMUX_TYPE report_spinlock = portMUX_INITIALIZER_UNLOCKED;
+/* notified on upload completion */
+static TaskHandle_t report_task;
+/* flash entries or records that could not be decoded */
+static uint32_t report_decode_errors;
+/* per lane counters, guarded by report_spinlock */
+static report_stats_t report_stats;
+/* last flash entry read */
+static uint8_t report_entry[REPORT_ENTRY_MAX_SIZE];
+/* flash ring size per lane */
+static size_t report_ring_size[REPORT_LANE_MAX];
+/* bytes stored and not released per lane, guarded by report_spinlock */
+static uint32_t report_ring_used[REPORT_LANE_MAX];
+/* bytes read by upload task and not released yet per lane */
+static uint32_t report_ring_read[REPORT_LANE_MAX];
+#ifdef CONFIG_REPORT_COMPACT
+/* wakes upload task waiting for connection when stored reports get old */
+static TimerHandle_t report_compact_timer;
+#endif
 
-/* starts upload task */
-void report_start(const esp_partition_t *partition)
+/* starts upload task, without priority partition all reports share one lane */
+void report_start(const esp_partition_t *partition, const esp_partition_t *priority_partition)
 {
 	BaseType_t ret;
 
-	report_fring_ctx = fring_init(partition);
-	ESP_ERROR_CHECK(report_fring_ctx == NULL ? ESP_ERR_NO_MEM : ESP_OK);
-	ret = xTaskCreate(report_upload_task, report_tag, 2048 + configMINIMAL_STACK_SIZE, NULL, TP_UPLOAD, NULL);
+	report_fring_ctx[REPORT_LANE_LOW] = fring_init(partition);
+	ESP_ERROR_CHECK(report_fring_ctx[REPORT_LANE_LOW] == NULL ? ESP_ERR_NO_MEM : ESP_OK);
+	report_ring_size[REPORT_LANE_LOW] = partition->size;
+	report_ring_used[REPORT_LANE_LOW] = report_ring_backlog(partition);
+	if(priority_partition)
+	{
+		report_fring_ctx[REPORT_LANE_HIGH] = fring_init(priority_partition);
+		ESP_ERROR_CHECK(report_fring_ctx[REPORT_LANE_HIGH] == NULL ? ESP_ERR_NO_MEM : ESP_OK);
+		report_ring_size[REPORT_LANE_HIGH] = priority_partition->size;
+		report_ring_used[REPORT_LANE_HIGH] = report_ring_backlog(priority_partition);
+	}
+	else
+		ESP_LOGW(report_tag, "No priority partition, single lane");
+	report_staging = xQueueCreate(CONFIG_REPORT_STAGING_SIZE, sizeof(report_staged_t));
+	ESP_ERROR_CHECK(report_staging == NULL ? ESP_ERR_NO_MEM : ESP_OK);
+	report_stored = xSemaphoreCreateBinary();
+	ESP_ERROR_CHECK(report_stored == NULL ? ESP_ERR_NO_MEM : ESP_OK);
+	report_flushed = xSemaphoreCreateBinary();
+	ESP_ERROR_CHECK(report_flushed == NULL ? ESP_ERR_NO_MEM : ESP_OK);
+	report_flush_lock = xSemaphoreCreateMutex();
+	ESP_ERROR_CHECK(report_flush_lock == NULL ? ESP_ERR_NO_MEM : ESP_OK);
+	ret = xTaskCreate(report_writer_task, "report_wr", 2048 + configMINIMAL_STACK_SIZE, NULL, TP_UPLOAD, NULL);
 	ESP_ERROR_CHECK(ret != pdPASS ? ESP_ERR_NO_MEM : ESP_OK);
+	ESP_ERROR_CHECK(esp_register_shutdown_handler(report_shutdown));
+	ret = xTaskCreate(report_upload_task, report_tag, 2048 + configMINIMAL_STACK_SIZE, NULL, TP_UPLOAD, &report_task);
+	ESP_ERROR_CHECK(ret != pdPASS ? ESP_ERR_NO_MEM : ESP_OK);
+#ifdef CONFIG_REPORT_COMPACT
+	report_compact_timer = xTimerCreate("compact", REPORT_COMPACT_CHECK, pdTRUE, NULL, report_compact_timer_cb);
+	ESP_ERROR_CHECK(report_compact_timer == NULL ? ESP_ERR_NO_MEM : ESP_OK);
+	xTimerStart(report_compact_timer, portMAX_DELAY);
+#endif
 }
 
-/* stores report data in flash, blocks until completion */
+/* stages report data to be stored in flash, blocks only if staging is full */
 void report_add(report_data_t *data)
 {
 	struct timeval sys_time;
+	report_staged_t staged;
 
 	/* add time if not set */
 	if(!data->when)
@@ -35,20 +184,618 @@ void report_add(report_data_t *data)
 		gettimeofday(&sys_time, NULL);
 		data->when = sys_time.tv_sec;
 	}
-	fring_write(report_fring_ctx, data, sizeof(report_data_t));
+	staged.data = *data;
+	staged.data.summarised = 0;
+	staged.flush = 0;
+	if(xQueueSend(report_staging, &staged, 0) != pdTRUE)
+	{
+		ESP_LOGW(report_tag, "Staging full");
+		xQueueSend(report_staging, &staged, portMAX_DELAY);
+	}
+}
+
+/* blocks until all reports added so far are stored in flash, false on timeout */
+bool report_flush(TickType_t timeout)
+{
+	static uint32_t seq;
+	report_staged_t staged;
+	TickType_t start = xTaskGetTickCount();
+	TickType_t elapsed;
+	bool done;
+
+	if(xSemaphoreTake(report_flush_lock, timeout) != pdTRUE)
+		return(false);
+	seq = seq + 1 ? seq + 1 : 1;
+	memset(&staged, 0, sizeof(staged));
+	staged.flush = seq;
+	if(xQueueSend(report_staging, &staged, timeout) == pdTRUE)
+	{
+		/* answer to an earlier request that timed out may come first */
+		while(report_flushed_seq != seq)
+		{
+			elapsed = xTaskGetTickCount() - start;
+			if(elapsed >= timeout || xSemaphoreTake(report_flushed, timeout - elapsed) != pdTRUE)
+				break;
+		}
+	}
+	done = report_flushed_seq == seq;
+	xSemaphoreGive(report_flush_lock);
+	return(done);
+}
+
+/* copies per lane counters */
+void report_get_stats(report_stats_t *stats)
+{
+	struct timeval sys_time;
+	report_lane_t lane;
+
+	taskENTER_CRITICAL(&report_spinlock);
+	*stats = report_stats;
+	taskEXIT_CRITICAL(&report_spinlock);
+	gettimeofday(&sys_time, NULL);
+	for(lane = 0; lane < REPORT_LANE_MAX; lane++)
+	{
+		if(stats->lanes[lane].oldest && sys_time.tv_sec > stats->lanes[lane].oldest)
+			stats->lanes[lane].age = sys_time.tv_sec - stats->lanes[lane].oldest;
+		stats->lanes[lane].fill = report_fill(lane);
+	}
+}
+
+/* lane for report kind, everything goes to low lane without priority partition */
+static report_lane_t report_lane(report_kind_t kind)
+{
+	report_lane_t lane = kind < REPORT_KIND_MAX ? report_kind_lanes[kind] : REPORT_LANE_LOW;
+
+	return(report_fring_ctx[lane] ? lane : REPORT_LANE_LOW);
+}
+
+/*
+stores staged reports, all reports waiting are written to flash at once, one entry per lane
+upload task waiting for connection is woken when a ring fills up to be compacted
+*/
+static void report_writer_task(void *arg)
+{
+	static report_data_t group[REPORT_LANE_MAX][CONFIG_REPORT_GROUP_SIZE];
+	static uint8_t entry[REPORT_CODEC_ENTRY_SIZE(CONFIG_REPORT_GROUP_SIZE)];
+	report_staged_t staged;
+	uint32_t flush;
+	size_t count[REPORT_LANE_MAX];
+	size_t total;
+	size_t len;
+	uint32_t fill;
+	report_lane_t lane;
+	(void)arg;
+
+	while(true)
+	{
+		memset(count, 0, sizeof(count));
+		total = 0;
+		flush = 0;
+		xQueueReceive(report_staging, &staged, portMAX_DELAY); /* block task until new data arrives */
+		do
+		{
+			if(staged.flush) /* everything before is in this group */
+			{
+				flush = staged.flush;
+				break;
+			}
+			lane = report_lane(staged.data.kind);
+			group[lane][count[lane]++] = staged.data;
+		} while(++total < CONFIG_REPORT_GROUP_SIZE && xQueueReceive(report_staging, &staged, 0) == pdTRUE);
+		for(lane = 0; lane < REPORT_LANE_MAX; lane++)
+		{
+			if(!count[lane])
+				continue;
+			len = report_codec_encode(entry, sizeof(entry), group[lane], count[lane]);
+			ESP_LOGD(report_tag, "Storing %u reports in %u B, lane %d", count[lane], len, lane);
+			fill = report_fill(lane);
+			fring_write(report_fring_ctx[lane], entry, len);
+			taskENTER_CRITICAL(&report_spinlock);
+			report_stats.lanes[lane].stored += count[lane];
+			report_stats.lanes[lane].backlog += count[lane];
+			report_ring_used[lane] += len;
+			taskEXIT_CRITICAL(&report_spinlock);
+#ifdef CONFIG_REPORT_COMPACT
+			if(fill < CONFIG_REPORT_COMPACT_FILL && report_fill(lane) >= CONFIG_REPORT_COMPACT_FILL)
+				cloud_report_wake();
+#else
+			(void)fill;
+#endif
+		}
+		if(total)
+			xSemaphoreGive(report_stored);
+		if(flush)
+		{
+			report_flushed_seq = flush;
+			xSemaphoreGive(report_flushed);
+		}
+	}
 }
 
-/* uploads reports to cloud */
+/* stores staged reports before restart */
+static void report_shutdown(void)
+{
+	if(!report_flush(REPORT_SHUTDOWN_FLUSH))
+		ESP_LOGE(report_tag, "Reports lost on restart");
+}
+
+/*
+uploads reports to cloud, up to CONFIG_REPORT_WINDOW batches are in flight at once
+flash ring can only confirm everything read so far, so the window is confirmed
+once all its batches are acknowledged, failed batches are uploaded again from RAM
+each window is filled from the high lane first, so security events wait at most
+for the window in flight instead of the whole backlog
+*/
 static void report_upload_task(void *arg)
 {
-	report_data_t data;
-	size_t data_size = 0;
+	cloud_retry_stats_t retry;
+	uint32_t attempts;
+	size_t slots;
 	(void)arg;
 
 	while(true)
 	{
-		fring_read(report_fring_ctx, &data, &data_size, portMAX_DELAY); /* block task until new data arrives */
-		cloud_report(&data); /* block task until upload completes */
-		fring_confirm_read(report_fring_ctx);
+		/* take what is already stored, block task until new data arrives if nothing */
+		slots = report_read_window(REPORT_BATCH_LINGER);
+		if(!slots)
+		{
+			xSemaphoreTake(report_stored, portMAX_DELAY);
+			continue;
+		}
+		ESP_LOGD(report_tag, "Uploading %u batches", slots);
+		attempts = 1;
+		while(!report_upload_window(slots))
+		{
+			attempts++;
+#ifdef CONFIG_REPORT_COMPACT
+			/* wait without connection is woken by writer task and compaction timer */
+			if(report_compact_window(slots)) /* all batches replaced by summaries */
+				break;
+#endif
+			cloud_report_wait();
+		}
+		if(attempts > 1)
+		{
+			cloud_get_retry_stats(&retry);
+			ESP_LOGI(report_tag, "Window done after %u attempts, %u retries and %u resets since boot, waited %llu ms", attempts, retry.retries, retry.resets, retry.wait_ms);
+		}
+		report_confirm_window(slots);
+	}
+}
+
+/*
+fills upload window from lanes in priority order, first batch lingers, returns number of slots filled
+batches hold at most CONFIG_REPORT_BATCH_SIZE reports, rest of the last entry read goes to following slots
+since flash ring releases whole entries, so batch size 1 always uploads every report to its own path
+*/
+static size_t report_read_window(TickType_t linger)
+{
+	size_t slots = 0;
+	report_lane_t lane;
+	time_t oldest[REPORT_LANE_MAX] = {0};
+
+	for(lane = 0; lane < REPORT_LANE_MAX; lane++)
+	{
+		if(!report_fring_ctx[lane])
+			continue;
+		while(slots < CONFIG_REPORT_WINDOW && report_read_batch(&report_window[slots], lane, 0, slots ? 0 : linger))
+		{
+			/* lanes are FIFO, first report read is the oldest waiting */
+			if(!oldest[lane] && report_window[slots].count)
+				oldest[lane] = report_window[slots].reports[0].when;
+			slots++;
+			while(report_window[slots - 1].count > CONFIG_REPORT_BATCH_SIZE)
+			{
+				report_split_batch(&report_window[slots - 1], &report_window[slots]);
+				slots++;
+			}
+		}
+	}
+	taskENTER_CRITICAL(&report_spinlock);
+	for(lane = 0; lane < REPORT_LANE_MAX; lane++)
+		report_stats.lanes[lane].oldest = oldest[lane];
+	taskEXIT_CRITICAL(&report_spinlock);
+	return(slots);
+}
+
+/* releases acknowledged window from flash and updates counters */
+static void report_confirm_window(size_t slots)
+{
+	uint32_t uploaded[REPORT_LANE_MAX] = {0};
+	bool read[REPORT_LANE_MAX] = {false};
+	report_lane_t lane;
+	size_t i;
+
+	for(i = 0; i < slots; i++)
+	{
+		uploaded[report_window[i].lane] += report_window[i].count;
+		read[report_window[i].lane] = true;
+	}
+	for(lane = 0; lane < REPORT_LANE_MAX; lane++)
+	{
+		if(!read[lane])
+			continue;
+		report_release(lane); /* releases all reports read so far */
+		taskENTER_CRITICAL(&report_spinlock);
+		report_stats.lanes[lane].uploaded += uploaded[lane];
+		report_stats.lanes[lane].backlog -= uploaded[lane] < report_stats.lanes[lane].backlog ? uploaded[lane] : report_stats.lanes[lane].backlog;
+		report_stats.lanes[lane].oldest = 0;
+		taskEXIT_CRITICAL(&report_spinlock);
+	}
+}
+
+/* reads up to CONFIG_REPORT_BATCH_SIZE reports of one lane, waits for more until linger time passes, false if none */
+static bool report_read_batch(report_slot_t *slot, report_lane_t lane, TickType_t wait, TickType_t linger)
+{
+	TickType_t start;
+	TickType_t elapsed;
+
+	slot->count = 0;
+	slot->state = REPORT_SLOT_IDLE;
+	slot->lane = lane;
+	if(!report_read_entry(slot, wait)) /* nothing stored */
+		return(false);
+	start = xTaskGetTickCount();
+	while(slot->count < CONFIG_REPORT_BATCH_SIZE)
+	{
+		elapsed = xTaskGetTickCount() - start;
+		if(!report_read_entry(slot, elapsed < linger ? linger - elapsed : 0)) /* nothing more */
+			break;
+	}
+	return(true);
+}
+
+/* reads one flash entry into report_entry and appends its reports to slot, returns entry size, 0 if none */
+static size_t report_read_entry(report_slot_t *slot, TickType_t wait)
+{
+	size_t data_size = 0;
+	uint32_t errors = report_decode_errors;
+
+	fring_read(report_fring_ctx[slot->lane], report_entry, &data_size, wait);
+	if(!data_size)
+		return(0);
+	report_ring_read[slot->lane] += data_size;
+	/* whole entry fits, slot has room for a group beyond batch size */
+	slot->count += report_codec_decode(report_entry, data_size, &slot->reports[slot->count], sizeof(slot->reports) / sizeof(slot->reports[0]) - slot->count, &report_decode_errors);
+	if(report_decode_errors != errors)
+		ESP_LOGW(report_tag, "Skipped undecodable reports in %u B entry", data_size);
+	return(data_size);
+}
+
+/*
+bytes of entries kept in ring over restart, read through a context of its own
+so the upload task still reads them, flash_ring has no call to free the context
+*/
+static uint32_t report_ring_backlog(const esp_partition_t *partition)
+{
+	fring_context_t *scan = fring_init(partition);
+	uint32_t used = 0;
+	size_t data_size;
+
+	if(!scan)
+		return(0);
+	do
+	{
+		data_size = 0;
+		fring_read(scan, report_entry, &data_size, 0);
+		used += data_size;
+	} while(data_size);
+	return(used);
+}
+
+/* confirms everything read from lane ring */
+static void report_release(report_lane_t lane)
+{
+	fring_confirm_read(report_fring_ctx[lane]);
+	taskENTER_CRITICAL(&report_spinlock);
+	/* entries kept over restart are not counted */
+	report_ring_used[lane] -= report_ring_read[lane] < report_ring_used[lane] ? report_ring_read[lane] : report_ring_used[lane];
+	taskEXIT_CRITICAL(&report_spinlock);
+	report_ring_read[lane] = 0;
+}
+
+/* share of lane ring taken by entries not released [%] */
+static uint32_t report_fill(report_lane_t lane)
+{
+	uint32_t used;
+
+	if(!report_ring_size[lane])
+		return(0);
+	taskENTER_CRITICAL(&report_spinlock);
+	used = report_ring_used[lane];
+	taskEXIT_CRITICAL(&report_spinlock);
+	return((uint32_t)((uint64_t)used * 100 / report_ring_size[lane]));
+}
+
+/* moves reports beyond batch size to next slot */
+static void report_split_batch(report_slot_t *slot, report_slot_t *next)
+{
+	next->count = slot->count - CONFIG_REPORT_BATCH_SIZE;
+	memcpy(next->reports, &slot->reports[CONFIG_REPORT_BATCH_SIZE], next->count * sizeof(report_data_t));
+	next->state = REPORT_SLOT_IDLE;
+	next->lane = slot->lane;
+	slot->count = CONFIG_REPORT_BATCH_SIZE;
+}
+
+/* starts uploads of unacknowledged batches and waits for them, true if all acknowledged */
+static bool report_upload_window(size_t slots)
+{
+	report_slot_t *slot;
+	TickType_t start;
+	TickType_t elapsed;
+	size_t done;
+	size_t i;
+
+	report_round = (report_round + 1) & (UINT32_MAX >> REPORT_SLOT_BITS); /* must fit callback argument */
+	for(i = 0; i < slots; i++)
+	{
+		slot = &report_window[i];
+		if(slot->state == REPORT_SLOT_DONE)
+			continue;
+		if(!slot->count) /* nothing decoded, released with the rest */
+		{
+			slot->state = REPORT_SLOT_DONE;
+			continue;
+		}
+		taskENTER_CRITICAL(&report_spinlock);
+		slot->round = report_round;
+		slot->state = REPORT_SLOT_PENDING;
+		taskEXIT_CRITICAL(&report_spinlock);
+		report_reqs[i].cb = report_upload_done_cb;
+		report_reqs[i].arg = (void *)(uintptr_t)((report_round << REPORT_SLOT_BITS) | i);
+		if(!cloud_report_async(slot->reports, slot->count, &report_reqs[i]))
+		{
+			taskENTER_CRITICAL(&report_spinlock);
+			slot->state = REPORT_SLOT_IDLE;
+			taskEXIT_CRITICAL(&report_spinlock);
+			break; /* no connection, retry later */
+		}
+	}
+	/* wait for started uploads */
+	start = xTaskGetTickCount();
+	while(true)
+	{
+		done = 0;
+		taskENTER_CRITICAL(&report_spinlock);
+		for(i = 0; i < slots; i++)
+		{
+			if(report_window[i].state == REPORT_SLOT_PENDING)
+				break;
+			done += report_window[i].state == REPORT_SLOT_DONE;
+		}
+		taskEXIT_CRITICAL(&report_spinlock);
+		if(i == slots) /* none pending */
+			return(done == slots);
+		elapsed = xTaskGetTickCount() - start;
+		if(elapsed >= REPORT_ACK_TIMEOUT) /* late acknowledgements are ignored */
+		{
+			ESP_LOGW(report_tag, "Upload acknowledgement timeout");
+			return(false);
+		}
+		ulTaskNotifyTake(pdTRUE, REPORT_ACK_TIMEOUT - elapsed);
+	}
+}
+
+/* called from cloud task on upload completion */
+static void report_upload_done_cb(bool success, void *arg)
+{
+	uint32_t tag = (uintptr_t)arg;
+	report_slot_t *slot = &report_window[tag & REPORT_SLOT_MASK];
+
+	taskENTER_CRITICAL(&report_spinlock);
+	if(slot->round == tag >> REPORT_SLOT_BITS && slot->state == REPORT_SLOT_PENDING)
+		slot->state = success ? REPORT_SLOT_DONE : REPORT_SLOT_IDLE;
+	taskEXIT_CRITICAL(&report_spinlock);
+	xTaskNotifyGive(report_task);
+}
+
+#ifdef CONFIG_REPORT_COMPACT
+/* wakes upload task waiting for connection if stored reports are old enough or a ring is filling up */
+static void report_compact_timer_cb(TimerHandle_t timer)
+{
+	struct timeval sys_time;
+	report_lane_t lane;
+	bool due = false;
+	(void)timer;
+
+	gettimeofday(&sys_time, NULL);
+	for(lane = 0; lane < REPORT_LANE_MAX; lane++)
+	{
+		taskENTER_CRITICAL(&report_spinlock);
+		if(report_stats.lanes[lane].oldest && sys_time.tv_sec >= REPORT_COMPACT_TIME_VALID &&
+				sys_time.tv_sec - report_stats.lanes[lane].oldest >= REPORT_COMPACT_AGE)
+			due = true;
+		taskEXIT_CRITICAL(&report_spinlock);
+		if(report_fill(lane) >= CONFIG_REPORT_COMPACT_FILL)
+			due = true;
+	}
+	if(due)
+		cloud_report_wake();
+}
+
+/* summarises old reports of lanes in failed window, reports of any age if ring is filling up, true if no batch is left to upload */
+static bool report_compact_window(size_t slots)
+{
+	struct timeval sys_time;
+	report_lane_t lane;
+	time_t age;
+	size_t i;
+
+	gettimeofday(&sys_time, NULL);
+	if(sys_time.tv_sec < REPORT_COMPACT_TIME_VALID)
+		return(false);
+	for(lane = 0; lane < REPORT_LANE_MAX; lane++)
+	{
+		age = report_fill(lane) >= CONFIG_REPORT_COMPACT_FILL ? 0 : REPORT_COMPACT_AGE;
+		if(report_compactable(slots, lane, sys_time.tv_sec, age))
+			report_compact_lane(slots, lane, sys_time.tv_sec, age);
+	}
+	for(i = 0; i < slots; i++)
+	{
+		if(report_window[i].state != REPORT_SLOT_DONE)
+			return(false);
+	}
+	return(true);
+}
+
+/*
+true if failed batches of lane hold old reports not summarised yet, summaries are not compacted again
+batches still in flight are left alone, their requests may be answered later
+*/
+static bool report_compactable(size_t slots, report_lane_t lane, time_t now, time_t age)
+{
+	report_slot_t *slot;
+	size_t i;
+	size_t j;
+
+	for(i = 0; i < slots; i++)
+	{
+		slot = &report_window[i];
+		if(slot->lane != lane || slot->state != REPORT_SLOT_IDLE)
+			continue;
+		for(j = 0; j < slot->count; j++)
+		{
+			if(!slot->reports[j].summarised && now - slot->reports[j].when >= age)
+				return(true);
+		}
+	}
+	return(false);
+}
+
+/*
+merges failed batches of lane and further stored entries into summaries, stops at the first
+entry newer than age which is stored back unchanged, summaries are stored before the ring
+is confirmed, the ring is confirmed first only if it is too full to take them
+*/
+static void report_compact_lane(size_t slots, report_lane_t lane, time_t now, time_t age)
+{
+	static report_data_t summaries[REPORT_COMPACT_MAX];
+	static report_slot_t stored;
+	static uint8_t entry[REPORT_CODEC_ENTRY_SIZE(CONFIG_REPORT_GROUP_SIZE)];
+	report_slot_t *slot;
+	size_t count = 0;
+	size_t merged = 0;
+	size_t young = 0;
+	size_t len;
+	size_t n;
+	size_t i;
+	size_t j;
+	bool released = false;
+
+	for(i = 0; i < slots; i++)
+	{
+		slot = &report_window[i];
+		taskENTER_CRITICAL(&report_spinlock);
+		if(slot->lane != lane || slot->state != REPORT_SLOT_IDLE)
+		{
+			taskEXIT_CRITICAL(&report_spinlock);
+			continue;
+		}
+		slot->state = REPORT_SLOT_DONE; /* answer to failed upload is ignored */
+		taskEXIT_CRITICAL(&report_spinlock);
+		for(j = 0; j < slot->count; j++)
+			count = report_compact_merge(summaries, count, &slot->reports[j], now, age);
+		merged += slot->count;
+		slot->count = 0;
+	}
+	/* read on while a whole entry fits, lanes are FIFO so entries after a young one are young too */
+	stored.lane = lane;
+	while(REPORT_COMPACT_MAX - count >= REPORT_BATCH_MAX)
+	{
+		stored.count = 0;
+		len = report_read_entry(&stored, 0);
+		if(!len)
+			break;
+		if(report_compact_young(&stored, now, age)) /* still in report_entry */
+		{
+			young = len;
+			break;
+		}
+		for(j = 0; j < stored.count; j++)
+			count = report_compact_merge(summaries, count, &stored.reports[j], now, age);
+		merged += stored.count;
+	}
+	for(i = 0; i < count; i += n)
+	{
+		n = count - i < CONFIG_REPORT_GROUP_SIZE ? count - i : CONFIG_REPORT_GROUP_SIZE;
+		len = report_codec_encode(entry, sizeof(entry), &summaries[i], n);
+		if(!report_compact_store(lane, entry, len, &released))
+		{
+			ESP_LOGE(report_tag, "%u summaries lost, lane %d", count - i, lane);
+			break;
+		}
+	}
+	if(young && (i < count || !report_compact_store(lane, report_entry, young, &released)))
+		ESP_LOGE(report_tag, "%u B entry lost, lane %d", young, lane);
+	if(!released)
+		report_release(lane);
+	ESP_LOGI(report_tag, "Compacted %u reports to %u, lane %d", merged, count, lane);
+	taskENTER_CRITICAL(&report_spinlock);
+	report_stats.lanes[lane].compacted += merged - count;
+	report_stats.lanes[lane].backlog -= merged - count < report_stats.lanes[lane].backlog ? merged - count : report_stats.lanes[lane].backlog;
+	report_stats.lanes[lane].oldest = 0;
+	taskEXIT_CRITICAL(&report_spinlock);
+}
+
+/* stores a compacted entry, confirms the ring first if it is full, false if the entry is lost */
+static bool report_compact_store(report_lane_t lane, const uint8_t *entry, size_t len, bool *released)
+{
+	esp_err_t ret;
+
+	ret = fring_write(report_fring_ctx[lane], entry, len);
+	if(ret != ESP_OK && !*released)
+	{
+		report_release(lane);
+		*released = true;
+		ret = fring_write(report_fring_ctx[lane], entry, len);
+	}
+	if(ret != ESP_OK)
+		return(false);
+	taskENTER_CRITICAL(&report_spinlock);
+	report_ring_used[lane] += len;
+	taskEXIT_CRITICAL(&report_spinlock);
+	return(true);
+}
+
+/* true if every report of the entry read is newer than age */
+static bool report_compact_young(const report_slot_t *slot, time_t now, time_t age)
+{
+	size_t i;
+
+	for(i = 0; i < slot->count; i++)
+	{
+		if(now - slot->reports[i].when >= age)
+			return(false);
+	}
+	return(slot->count > 0);
+}
+
+/* adds report to summaries, reports of at least age of same kind, card, slot and day are merged, returns new count */
+static size_t report_compact_merge(report_data_t *summaries, size_t count, const report_data_t *report, time_t now, time_t age)
+{
+	report_data_t *summary;
+	uint16_t reports = report->summarised ? report->summarised : 1;
+	size_t i;
+
+	if(now - report->when < age) /* kept as is */
+	{
+		summaries[count] = *report;
+		return(count + 1);
+	}
+	for(i = 0; i < count; i++)
+	{
+		summary = &summaries[i];
+		if(summary->summarised && summary->kind == report->kind && summary->card_id == report->card_id && summary->slot_id == report->slot_id &&
+				summary->when / REPORT_COMPACT_DAY == report->when / REPORT_COMPACT_DAY && summary->summarised <= UINT16_MAX - reports)
+		{
+			summary->summarised += reports;
+			if(report->when < summary->when) /* summary holds time of first report */
+				summary->when = report->when;
+			return(count);
+		}
 	}
+	summaries[count] = *report;
+	summaries[count].summarised = reports;
+	return(count + 1);
 }
+#endif
@@ -2,25 +2,41 @@
 #define MAIN_REPORT_MANAGER_H_
 
 #include <time.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
 #include "esp_partition.h"
+#include "report_codec.h"
 
-/* report content types */
+/* most reports read into one batch, last flash entry of a batch is read whole, uploads hold at most CONFIG_REPORT_BATCH_SIZE */
+#define REPORT_BATCH_MAX (CONFIG_REPORT_BATCH_SIZE + CONFIG_REPORT_GROUP_SIZE - 1)
+
+/* upload priority lanes, each stored in its own flash ring, drained in this order */
 typedef enum {
-	REPORT_KIND_SLOT_OPEN,
-	REPORT_KIND_NEW_CARD,
-	REPORT_KIND_MAX
-} report_kind_t;
+	REPORT_LANE_HIGH, /* security events */
+	REPORT_LANE_LOW,
+	REPORT_LANE_MAX
+} report_lane_t;
+
+/* per lane counters */
+typedef struct
+{
+	uint32_t stored; /* reports written to flash since boot */
+	uint32_t uploaded; /* reports acknowledged since boot */
+	uint32_t backlog; /* stored but not acknowledged, reports kept in flash over restart are not counted */
+	uint32_t compacted; /* records removed by merging them into summaries */
+	uint32_t fill; /* share of flash ring used by stored reports not released [%] */
+	time_t oldest; /* oldest report being uploaded, 0 if none */
+	uint32_t age; /* seconds since oldest */
+} report_lane_stats_t;
 
-/* report data structure */
 typedef struct
 {
-	report_kind_t kind;
-	time_t when;
-	uint64_t card_id;
-	uint8_t slot_id;
-} report_data_t;
+	report_lane_stats_t lanes[REPORT_LANE_MAX];
+} report_stats_t;
 
-void report_start(const esp_partition_t *partition);
+void report_start(const esp_partition_t *partition, const esp_partition_t *priority_partition);
 void report_add(report_data_t *data);
+bool report_flush(TickType_t timeout);
+void report_get_stats(report_stats_t *stats);
 
 #endif /* MAIN_REPORT_MANAGER_H_ */
@@ -0,0 +1,140 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "acl_codec.h"
+#ifdef ACL_BENCH_CJSON
+#include "cJSON.h"
+#endif
+
+#define BENCH_ID_MASK 0xFFFFFFFFFFull
+
+/* counted through -Wl,--wrap=malloc */
+void *__real_malloc(size_t size);
+static size_t bench_allocs;
+
+void *__wrap_malloc(size_t size)
+{
+	bench_allocs++;
+	return(__real_malloc(size));
+}
+
+static uint32_t bench_rand_state = 1;
+
+static uint32_t bench_rand(void)
+{
+	bench_rand_state ^= bench_rand_state << 13;
+	bench_rand_state ^= bench_rand_state >> 17;
+	bench_rand_state ^= bench_rand_state << 5;
+	return(bench_rand_state);
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static bool bench_entry_cb(uint64_t card_id, uint8_t slots, void *arg)
+{
+	*(uint64_t *)arg += card_id + slots;
+	return(true);
+}
+
+/* {"gen": 1, "acl": ["hexid:slots", ...]} as sent by the cloud */
+static size_t bench_json(char *buf, size_t count)
+{
+	size_t len = (size_t)sprintf(buf, "{\"gen\": 1, \"acl\": [");
+	size_t i;
+
+	for(i = 0; i < count; i++)
+		len += (size_t)sprintf(buf + len, "%s\"%llx:%x\"", i ? ", " : "", ((unsigned long long)bench_rand() << 32 | bench_rand()) & BENCH_ID_MASK, bench_rand() & 0xFF);
+	len += (size_t)sprintf(buf + len, "]}");
+	return(len);
+}
+
+static void bench_report(const char *name, size_t count, size_t len, double elapsed, int rounds, size_t allocs)
+{
+	printf("%-8s %6zu cards: %8.1f ns/card %8.1f MB/s %6zu allocations/parse\n", name, count,
+			elapsed * 1e9 / ((double)rounds * count), (double)rounds * len / elapsed / 1e6, allocs / rounds);
+}
+
+#ifdef ACL_BENCH_CJSON
+/* parse of the original cloud manager, tree of the whole document walked by index */
+static uint64_t bench_cjson(const char *buf)
+{
+	cJSON *doc = cJSON_Parse(buf);
+	cJSON *acl = cJSON_GetObjectItem(doc, "acl");
+	cJSON *item;
+	char *card_id_str;
+	char *slots_str;
+	uint64_t sum = 0;
+	int count = cJSON_GetArraySize(acl);
+	int i;
+
+	for(i = 0; i < count; i++)
+	{
+		item = cJSON_GetArrayItem(acl, i);
+		if(!cJSON_IsString(item))
+			continue;
+		card_id_str = strtok(cJSON_GetStringValue(item), ":");
+		slots_str = strtok(NULL, ":");
+		sum += strtoull(card_id_str, NULL, 16) + (slots_str ? strtoul(slots_str, NULL, 16) : 0);
+	}
+	cJSON_Delete(doc);
+	return(sum);
+}
+#endif
+
+/* full acl parse time and allocations, both passes of the cloud manager */
+int main(int argc, char **argv)
+{
+	static const size_t sizes[] = {100, 1000, 10000, 21824};
+	int rounds = argc > 1 ? atoi(argv[1]) : 20;
+	acl_codec_doc_t doc;
+	uint64_t sum = 0;
+	char *buf;
+	size_t len;
+	size_t allocs;
+	size_t n;
+	int round;
+	double start;
+
+	for(n = 0; n < sizeof(sizes) / sizeof(sizes[0]); n++)
+	{
+		buf = malloc(sizes[n] * 20 + 32);
+		len = bench_json(buf, sizes[n]);
+		allocs = bench_allocs;
+		start = bench_now();
+		for(round = 0; round < rounds; round++)
+		{
+			if(!acl_codec_parse_json(buf, len, &doc, NULL, NULL) || !acl_codec_parse_json(buf, len, &doc, bench_entry_cb, &sum))
+				return(EXIT_FAILURE);
+		}
+		bench_report("codec", sizes[n], len, bench_now() - start, rounds, bench_allocs - allocs);
+#ifdef ACL_BENCH_CJSON
+		{
+			char *copy = malloc(len + 1);
+
+			allocs = bench_allocs;
+			start = bench_now();
+			for(round = 0; round < rounds; round++)
+			{
+				memcpy(copy, buf, len + 1);
+				sum += bench_cjson(copy);
+			}
+			bench_report("cJSON", sizes[n], len, bench_now() - start, rounds, bench_allocs - allocs - 1);
+			free(copy);
+		}
+#endif
+		free(buf);
+	}
+#ifndef ACL_BENCH_CJSON
+	printf("cJSON not found, set CJSON_DIR or IDF_PATH to compare with the original parser\n");
+#endif
+	return(sum ? EXIT_SUCCESS : EXIT_FAILURE);
+}
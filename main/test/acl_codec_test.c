@@ -0,0 +1,143 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "acl_codec.h"
+
+#define TEST_MAX_ENTRIES 64
+
+typedef struct {
+	uint64_t card_id[TEST_MAX_ENTRIES];
+	uint8_t slots[TEST_MAX_ENTRIES];
+	size_t count;
+	size_t stop_at; /* callback stops parsing at this entry, 0 never */
+} test_entries_t;
+
+static int test_failures;
+
+#define TEST_CHECK(cond, ...) do { \
+	if(!(cond)) \
+	{ \
+		printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		test_failures++; \
+	} \
+} while(0)
+
+static bool test_entry_cb(uint64_t card_id, uint8_t slots, void *arg)
+{
+	test_entries_t *entries = arg;
+
+	if(entries->count < TEST_MAX_ENTRIES)
+	{
+		entries->card_id[entries->count] = card_id;
+		entries->slots[entries->count] = slots;
+	}
+	entries->count++;
+	return(entries->count != entries->stop_at);
+}
+
+static bool test_parse(const char *json, acl_codec_doc_t *doc, test_entries_t *entries)
+{
+	memset(entries, 0, sizeof(*entries));
+	return(acl_codec_parse_json(json, strlen(json), doc, test_entry_cb, entries));
+}
+
+static void test_entry(void)
+{
+	uint64_t card_id;
+	uint8_t slots;
+
+	TEST_CHECK(acl_codec_parse_entry("1a2B3c4D5e:0f", 13, &card_id, &slots) && card_id == 0x1A2B3C4D5Eull && slots == 0x0F, "id and slots");
+	TEST_CHECK(acl_codec_parse_entry("ff", 2, &card_id, &slots) && card_id == 0xFF && slots == 0, "slots are optional");
+	TEST_CHECK(acl_codec_parse_entry("ffffffffff:1", 12, &card_id, &slots) && card_id == 0xFFFFFFFFFFull && slots == 1, "10 digit id");
+	TEST_CHECK(!acl_codec_parse_entry("1ffffffffff:1", 13, &card_id, &slots), "11 digit id");
+	TEST_CHECK(!acl_codec_parse_entry("ffffffffffffffff:1", 18, &card_id, &slots), "16 digit id");
+	TEST_CHECK(!acl_codec_parse_entry("12:123", 6, &card_id, &slots), "3 digit slots");
+	TEST_CHECK(!acl_codec_parse_entry("12:", 3, &card_id, &slots), "empty slots");
+	TEST_CHECK(!acl_codec_parse_entry(":12", 3, &card_id, &slots), "empty id");
+	TEST_CHECK(!acl_codec_parse_entry("xyz:1", 5, &card_id, &slots), "not hex");
+	TEST_CHECK(!acl_codec_parse_entry("12:1 ", 5, &card_id, &slots), "trailing space");
+	/* length limits the entry, not the terminator */
+	TEST_CHECK(acl_codec_parse_entry("12:34", 4, &card_id, &slots) && card_id == 0x12 && slots == 3, "length");
+}
+
+static void test_json(void)
+{
+	acl_codec_doc_t doc;
+	test_entries_t entries;
+
+	TEST_CHECK(test_parse(" [\"0a:1\", \"0B:ff\"]\n", &doc, &entries), "legacy array");
+	TEST_CHECK(doc.version == 1 && doc.has_acl && !doc.has_generation && doc.entries == 2 && !doc.skipped, "legacy array summary");
+	TEST_CHECK(entries.count == 2 && entries.card_id[0] == 0x0A && entries.slots[0] == 1 && entries.card_id[1] == 0x0B && entries.slots[1] == 0xFF, "legacy array entries");
+	TEST_CHECK(test_parse("[]", &doc, &entries) && doc.has_acl && !doc.entries, "empty array");
+	TEST_CHECK(test_parse("{\"gen\": 42, \"x\": {\"y\": [1, \"]\", null]}, \"acl\": [\"1:2\", 5, \"xyz\", \"3:4\"]}", &doc, &entries), "object");
+	TEST_CHECK(doc.has_generation && doc.generation == 42 && doc.has_acl && doc.entries == 2 && doc.skipped == 1, "object summary");
+	TEST_CHECK(entries.count == 2 && entries.card_id[1] == 3 && entries.slots[1] == 4, "object entries");
+	/* ids wider than the 5 bytes stored are skipped, not truncated */
+	TEST_CHECK(test_parse("[\"ffffffffff:1\", \"1ffffffffff:2\", \"3:4\"]", &doc, &entries), "wide id");
+	TEST_CHECK(doc.entries == 2 && doc.skipped == 1 && entries.count == 2 && entries.card_id[1] == 3, "wide id skipped");
+	TEST_CHECK(test_parse("{\"gen\": 7}", &doc, &entries) && doc.has_generation && !doc.has_acl, "generation only");
+	TEST_CHECK(test_parse("[\"1:2\"]\0garbage", &doc, &entries), "string terminator ends document");
+	/* malformed documents are rejected */
+	TEST_CHECK(!test_parse("", &doc, &entries), "empty");
+	TEST_CHECK(!test_parse("[\"1:2\"", &doc, &entries), "unterminated array");
+	TEST_CHECK(!test_parse("[\"1:2]", &doc, &entries), "unterminated string");
+	TEST_CHECK(!test_parse("[\"1:2\" \"3:4\"]", &doc, &entries), "missing comma");
+	TEST_CHECK(!test_parse("[\"1:2\"] x", &doc, &entries), "trailing data");
+	TEST_CHECK(!test_parse("{\"gen\": -1, \"acl\": []}", &doc, &entries), "negative generation");
+	TEST_CHECK(!test_parse("{\"gen\": 4294967296}", &doc, &entries), "generation over 32 bits");
+	TEST_CHECK(!test_parse("{\"v\": 3, \"acl\": []}", &doc, &entries), "newer version");
+	TEST_CHECK(!test_parse("{\"acl\": [], }", &doc, &entries), "trailing comma");
+	/* callback can stop parsing */
+	memset(&entries, 0, sizeof(entries));
+	entries.stop_at = 1;
+	TEST_CHECK(!acl_codec_parse_json("[\"1\", \"2\"]", 10, &doc, test_entry_cb, &entries) && entries.count == 1, "stopped by callback");
+	/* validation pass without callback */
+	TEST_CHECK(acl_codec_parse_json("[\"1\", \"2\"]", 10, &doc, NULL, NULL) && doc.entries == 2, "no callback");
+}
+
+static void test_bin(void)
+{
+	acl_codec_doc_t doc;
+	test_entries_t entries;
+
+	/* flags 0, records 0102030405:06 and 0a0b0c0d0e:0f, little endian ids */
+	TEST_CHECK(test_parse("{\"v\": 2, \"gen\": 9, \"bin\": \"AAUEAwIBBg4NDAsKDw==\"}", &doc, &entries), "binary");
+	TEST_CHECK(doc.version == 2 && doc.generation == 9 && doc.has_acl && doc.entries == 2, "binary summary");
+	TEST_CHECK(entries.count == 2 && entries.card_id[0] == 0x0102030405ull && entries.slots[0] == 6 &&
+			entries.card_id[1] == 0x0A0B0C0D0Eull && entries.slots[1] == 0x0F, "binary entries");
+	/* delta flag, ids 300 and 301 as varints 0xAC 0x02 and 0x01 */
+	TEST_CHECK(test_parse("{\"v\": 2, \"bin\": \"AawCBwEI\"}", &doc, &entries), "binary delta");
+	TEST_CHECK(entries.count == 2 && entries.card_id[0] == 300 && entries.slots[0] == 7 && entries.card_id[1] == 301 && entries.slots[1] == 8, "binary delta entries");
+	/* first id may be 0, repeated ids and ids over 40 bits are rejected */
+	TEST_CHECK(test_parse("{\"v\": 2, \"bin\": \"AQAH\"}", &doc, &entries) && entries.count == 1 && entries.card_id[0] == 0, "binary delta id 0");
+	TEST_CHECK(!test_parse("{\"v\": 2, \"bin\": \"AQAHAAg=\"}", &doc, &entries), "binary delta repeated id");
+	TEST_CHECK(test_parse("{\"v\": 2, \"bin\": \"Af//////Hwc=\"}", &doc, &entries) && entries.count == 1 && entries.card_id[0] == 0xFFFFFFFFFFull, "binary delta 40 bit id");
+	TEST_CHECK(!test_parse("{\"v\": 2, \"bin\": \"AYCAgICAIAc=\"}", &doc, &entries), "binary delta 41 bit id");
+	TEST_CHECK(!test_parse("{\"v\": 2, \"bin\": \"Af7/////HwcCCA==\"}", &doc, &entries), "binary delta sum over 40 bits");
+	/* url safe alphabet and escaped slash are accepted */
+	TEST_CHECK(test_parse("{\"v\": 2, \"bin\": \"AP_-AAAAAA==\"}", &doc, &entries) && entries.count == 1 && entries.card_id[0] == 0xFEFF, "url safe alphabet");
+	TEST_CHECK(test_parse("{\"v\": 2, \"bin\": \"AP\\/-AAAAAA==\"}", &doc, &entries) && entries.count == 1 && entries.card_id[0] == 0xFEFF, "escaped slash");
+	/* records cut short or bad digits are rejected */
+	TEST_CHECK(!test_parse("{\"v\": 2, \"bin\": \"AAUEAwIB\"}", &doc, &entries), "partial record");
+	TEST_CHECK(!test_parse("{\"v\": 2, \"bin\": \"AawC\"}", &doc, &entries), "delta without slots");
+	TEST_CHECK(!test_parse("{\"v\": 2, \"bin\": \"\"}", &doc, &entries), "no flags");
+	TEST_CHECK(!test_parse("{\"v\": 2, \"bin\": \"AA*A\"}", &doc, &entries), "bad digit");
+}
+
+int main(void)
+{
+	test_entry();
+	test_json();
+	test_bin();
+	if(test_failures)
+	{
+		printf("%d checks failed\n", test_failures);
+		return(EXIT_FAILURE);
+	}
+	printf("all checks passed\n");
+	return(EXIT_SUCCESS);
+}
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "acl_store.h"
+#include "host_fake.h"
+
+/* acl partition size of partitions.csv */
+#define BENCH_PARTITION_SIZE (384 * 1024)
+#define BENCH_ID_MASK 0xFFFFFFFFFFull
+#define BENCH_LOOKUPS 200000
+
+static uint32_t bench_rand_state = 1;
+static ac_t *bench_acl;
+static size_t bench_acl_len;
+
+static uint32_t bench_rand(void)
+{
+	bench_rand_state ^= bench_rand_state << 13;
+	bench_rand_state ^= bench_rand_state >> 17;
+	bench_rand_state ^= bench_rand_state << 5;
+	return(bench_rand_state);
+}
+
+static uint64_t bench_rand_id(void)
+{
+	return(((uint64_t)bench_rand() << 32 | bench_rand()) & BENCH_ID_MASK);
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/* lookup of the original access manager, rebuilds every card id of the acl array */
+static bool bench_linear_find(uint64_t card_id, uint8_t *slots)
+{
+	uint64_t id;
+	size_t i;
+	int j;
+
+	for(i = 0; i < bench_acl_len; i++)
+	{
+		id = 0;
+		for(j = CARD_ID_BYTE_4; j >= CARD_ID_BYTE_0; j--)
+			id = (id << 8) | bench_acl[i].data[j];
+		if(id == card_id)
+		{
+			*slots = bench_acl[i].data[SLOTS_BYTE];
+			return(true);
+		}
+	}
+	return(false);
+}
+
+static double bench_lookups(bool (*find)(uint64_t, uint8_t *), const uint64_t *ids, size_t count, size_t *found)
+{
+	uint8_t slots;
+	double start = bench_now();
+	size_t i;
+
+	*found = 0;
+	for(i = 0; i < count; i++)
+		*found += find(ids[i], &slots);
+	return((bench_now() - start) * 1e9 / count);
+}
+
+/* hits and misses of the acl store against the linear scan it replaced */
+int main(void)
+{
+	const esp_partition_t *partition = host_partition_create("acl", BENCH_PARTITION_SIZE);
+	static uint64_t hits[BENCH_LOOKUPS];
+	static uint64_t misses[BENCH_LOOKUPS];
+	uint64_t *bench_ids = NULL;
+	size_t sizes[] = {100, 10000, 0};
+	size_t linear_lookups;
+	size_t found;
+	size_t n;
+	size_t i;
+	int j;
+	nvs_handle_t handle;
+	acl_store_stats_t stats;
+	double store_hit;
+	double store_miss;
+	double linear_hit;
+	double linear_miss;
+
+	nvs_open("access", NVS_READWRITE, &handle);
+	if(acl_store_init(partition, handle) != ESP_OK)
+		return(EXIT_FAILURE);
+	sizes[2] = acl_store_capacity();
+	printf("capacity %u cards with a %u kB partition, 100000 cards do not fit\n", acl_store_capacity(), BENCH_PARTITION_SIZE / 1024);
+	printf("%8s %14s %14s %14s %14s\n", "cards", "store hit", "store miss", "linear hit", "linear miss");
+	for(n = 0; n < sizeof(sizes) / sizeof(sizes[0]); n++)
+	{
+		bench_ids = realloc(bench_ids, sizes[n] * sizeof(uint64_t));
+		bench_acl = realloc(bench_acl, sizes[n] * sizeof(ac_t));
+		bench_acl_len = sizes[n];
+		acl_store_begin();
+		for(i = 0; i < bench_acl_len; i++)
+		{
+			bench_ids[i] = bench_rand_id();
+			for(j = CARD_ID_BYTE_0; j <= CARD_ID_BYTE_4; j++)
+				bench_acl[i].data[j] = (uint8_t)(bench_ids[i] >> (8 * j));
+			bench_acl[i].data[SLOTS_BYTE] = (uint8_t)i;
+			acl_store_add(bench_ids[i], (uint8_t)i);
+		}
+		if(acl_store_commit((uint32_t)n + 1) != ESP_OK)
+			return(EXIT_FAILURE);
+		for(i = 0; i < BENCH_LOOKUPS; i++)
+		{
+			hits[i] = bench_ids[bench_rand() % bench_acl_len];
+			misses[i] = bench_rand_id() | 1ull << 40; /* never stored */
+		}
+		store_hit = bench_lookups(acl_store_find, hits, BENCH_LOOKUPS, &found);
+		store_miss = bench_lookups(acl_store_find, misses, BENCH_LOOKUPS, &found);
+		/* linear scan is slow, fewer lookups on large acls */
+		linear_lookups = BENCH_LOOKUPS / (1 + bench_acl_len / 100);
+		linear_hit = bench_lookups(bench_linear_find, hits, linear_lookups, &found);
+		linear_miss = bench_lookups(bench_linear_find, misses, linear_lookups, &found);
+		printf("%8zu %11.1f ns %11.1f ns %11.1f ns %11.1f ns\n", bench_acl_len, store_hit, store_miss, linear_hit, linear_miss);
+	}
+	acl_store_get_stats(&stats);
+	printf("filter rejected %u of %u bank lookups, %u false positives\n", stats.filter_rejects, stats.bank_lookups, stats.filter_false_positives);
+	free(bench_ids);
+	free(bench_acl);
+	return(EXIT_SUCCESS);
+}
@@ -0,0 +1,323 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "acl_store.h"
+#include "host_fake.h"
+
+/* acl partition size of partitions.csv */
+#define TEST_PARTITION_SIZE (384 * 1024)
+#define TEST_ID_MASK 0xFFFFFFFFFFull
+/* cards stored by the legacy blob test */
+#define TEST_LEGACY_CARDS 60
+/* stored overlay header, state sequence number and generation */
+#define TEST_OVERLAY_HEAD (2 * sizeof(uint32_t))
+
+static int test_failures;
+static uint32_t test_rand_state = 1;
+static uint64_t *test_ids;
+static size_t test_ids_len;
+
+#define TEST_CHECK(cond, ...) do { \
+	if(!(cond)) \
+	{ \
+		printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		test_failures++; \
+	} \
+} while(0)
+
+static uint32_t test_rand(void)
+{
+	test_rand_state ^= test_rand_state << 13;
+	test_rand_state ^= test_rand_state >> 17;
+	test_rand_state ^= test_rand_state << 5;
+	return(test_rand_state);
+}
+
+static uint64_t test_rand_id(void)
+{
+	return(((uint64_t)test_rand() << 32 | test_rand()) & TEST_ID_MASK);
+}
+
+static int test_compare(const void *a, const void *b)
+{
+	uint64_t id_a = *(const uint64_t *)a;
+	uint64_t id_b = *(const uint64_t *)b;
+
+	return((id_a > id_b) - (id_a < id_b));
+}
+
+/* count limited to what the store holds, the legacy blob without partition is small */
+static size_t test_fit(size_t count)
+{
+	return(count < acl_store_capacity() ? count : acl_store_capacity());
+}
+
+static bool test_known(uint64_t card_id)
+{
+	return(bsearch(&card_id, test_ids, test_ids_len, sizeof(uint64_t), test_compare) != NULL);
+}
+
+/* stores count random cards in random order, optionally some twice, slots are the low id byte */
+static void test_build(size_t count, bool repeat, uint32_t generation)
+{
+	size_t i;
+	esp_err_t ret;
+
+	test_ids = realloc(test_ids, count * sizeof(uint64_t));
+	for(i = 0; i < count; i++)
+		test_ids[i] = test_rand_id();
+	TEST_CHECK(acl_store_begin() == ESP_OK, "begin");
+	for(i = 0; i < count; i++)
+	{
+		ret = acl_store_add(test_ids[i], (uint8_t)test_ids[i]);
+		TEST_CHECK(ret == ESP_OK, "add %zu of %zu failed %d", i, count, ret);
+		if(repeat && !(i % 7))
+			acl_store_add(test_ids[i / 2], (uint8_t)test_ids[i / 2]);
+	}
+	TEST_CHECK(acl_store_commit(generation) == ESP_OK, "commit of %zu cards", count);
+	qsort(test_ids, count, sizeof(uint64_t), test_compare);
+	test_ids_len = 0;
+	for(i = 0; i < count; i++) /* random ids may repeat */
+	{
+		if(!test_ids_len || test_ids[i] != test_ids[test_ids_len - 1])
+			test_ids[test_ids_len++] = test_ids[i];
+	}
+}
+
+static void test_lookups(const char *name)
+{
+	uint8_t slots;
+	uint64_t card_id;
+	size_t i;
+
+	for(i = 0; i < test_ids_len; i++)
+	{
+		slots = 0;
+		TEST_CHECK(acl_store_find(test_ids[i], &slots) && slots == (uint8_t)test_ids[i], "%s: card %zu not found", name, i);
+	}
+	for(i = 0; i < 10000; i++)
+	{
+		card_id = test_rand_id();
+		if(!test_known(card_id))
+			TEST_CHECK(!acl_store_find(card_id, &slots), "%s: unknown card found", name);
+	}
+}
+
+static void test_rebuild(void)
+{
+	static const size_t sizes[] = {0, 1, 100, 10000};
+	size_t i;
+
+	for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	{
+		if(sizes[i] > acl_store_capacity() / 2) /* room for repeated cards */
+			continue;
+		test_build(sizes[i], true, (uint32_t)i + 1);
+		TEST_CHECK(acl_store_count() == test_ids_len, "%zu cards stored, %zu expected", (size_t)acl_store_count(), test_ids_len);
+		TEST_CHECK(acl_store_generation() == i + 1, "generation");
+		test_lookups("rebuild");
+	}
+	/* full store, one more card is refused */
+	test_build(acl_store_capacity(), false, 10);
+	test_lookups("full");
+	TEST_CHECK(acl_store_begin() == ESP_OK, "begin");
+	for(i = 0; i < acl_store_capacity(); i++)
+		acl_store_add(i, 0);
+	TEST_CHECK(acl_store_add(i, 0) == ESP_ERR_NO_MEM, "card over capacity accepted");
+	acl_store_abort();
+	test_lookups("aborted");
+}
+
+/* pending changes override the bank, survive a reload and are merged when full */
+static void test_delta(void)
+{
+	uint8_t slots;
+	uint64_t added[3 * CONFIG_ACL_DELTA_MAX];
+	size_t i;
+
+	test_build(test_fit(1000) / 2, true, 20);
+	TEST_CHECK(acl_store_remove(test_ids[0]) == ESP_OK, "remove");
+	TEST_CHECK(acl_store_set(test_ids[1], 0x55) == ESP_OK, "set");
+	TEST_CHECK(!acl_store_find(test_ids[0], NULL), "removed card found");
+	TEST_CHECK(acl_store_find(test_ids[1], &slots) && slots == 0x55, "changed card slots");
+	TEST_CHECK(acl_store_save_delta(21) == ESP_OK, "save delta");
+	TEST_CHECK(acl_store_load() == ESP_OK, "reload");
+	TEST_CHECK(acl_store_generation() == 21, "generation after reload");
+	TEST_CHECK(!acl_store_find(test_ids[0], NULL), "removed card found after reload");
+	TEST_CHECK(acl_store_find(test_ids[1], &slots) && slots == 0x55, "changed card slots after reload");
+	for(i = 0; i < sizeof(added) / sizeof(added[0]); i++)
+	{
+		added[i] = test_rand_id();
+		TEST_CHECK(acl_store_set(added[i], 1) == ESP_OK, "set %zu", i);
+	}
+	TEST_CHECK(acl_store_save_delta(22) == ESP_OK, "save delta");
+	for(i = 0; i < sizeof(added) / sizeof(added[0]); i++)
+		TEST_CHECK(acl_store_find(added[i], NULL), "added card %zu not found", i);
+	TEST_CHECK(!acl_store_find(test_ids[0], NULL), "removed card found after merge");
+	TEST_CHECK(acl_store_find(test_ids[2], NULL), "bank card lost in merge");
+}
+
+/* with a filter every bank lookup is a hit, a reject or a false positive, without one misses are not counted */
+static void test_stats(void)
+{
+	acl_store_stats_t before;
+	acl_store_stats_t after;
+	uint32_t hits = 0;
+	size_t i;
+
+	test_build(test_fit(1000), false, 30);
+	acl_store_get_stats(&before);
+	for(i = 0; i < test_ids_len; i++)
+		hits += acl_store_find(test_ids[i], NULL);
+	for(i = 0; i < 10000; i++)
+		hits += acl_store_find(test_rand_id() | 1ull << 40, NULL);
+	acl_store_get_stats(&after);
+	TEST_CHECK(hits == test_ids_len, "%u hits of %zu cards", hits, test_ids_len);
+	TEST_CHECK(after.bank_lookups - before.bank_lookups == test_ids_len + 10000, "bank lookups");
+	if(CONFIG_ACL_BLOOM_SIZE)
+	{
+		TEST_CHECK(after.bank_lookups - before.bank_lookups == hits + (after.filter_rejects - before.filter_rejects) +
+				(after.filter_false_positives - before.filter_false_positives), "lookups do not add up");
+		TEST_CHECK(after.filter_rejects - before.filter_rejects > 9000, "filter rejected %u of 10000",
+				after.filter_rejects - before.filter_rejects);
+	}
+	else
+	{
+		TEST_CHECK(!after.filter_rejects && !after.filter_false_positives && after.filter_fp_rate == 0.0f,
+				"filter counters without filter, %u rejects, %u false positives", after.filter_rejects, after.filter_false_positives);
+	}
+}
+
+/* acl left in NVS by older firmware is used unsorted as it is, rebuilds switch to the other blob */
+static void test_legacy_blob(nvs_handle_t handle)
+{
+	ac_t legacy[ACL_STORE_LEGACY_LEN];
+	uint64_t card_id;
+	size_t len = 0;
+	size_t i;
+	size_t j;
+
+	memset(legacy, 0, sizeof(legacy));
+	test_ids = realloc(test_ids, TEST_LEGACY_CARDS * sizeof(uint64_t));
+	for(i = 0; i < TEST_LEGACY_CARDS; i++)
+	{
+		card_id = test_rand_id();
+		test_ids[i] = card_id;
+		for(j = 0; j < 5; j++)
+			legacy[i].data[CARD_ID_BYTE_0 + j] = (uint8_t)(card_id >> (8 * j));
+		legacy[i].data[SLOTS_BYTE] = (uint8_t)card_id;
+	}
+	qsort(test_ids, TEST_LEGACY_CARDS, sizeof(uint64_t), test_compare);
+	test_ids_len = TEST_LEGACY_CARDS;
+	/* whole blob of older firmware, counter tells the valid records */
+	nvs_set_u8(handle, "acl_counter", TEST_LEGACY_CARDS);
+	nvs_set_blob(handle, "acl", legacy, sizeof(legacy));
+	TEST_CHECK(acl_store_load() == ESP_OK, "load legacy blob");
+	TEST_CHECK(acl_store_count() == TEST_LEGACY_CARDS, "%u legacy cards loaded", (unsigned)acl_store_count());
+	TEST_CHECK(acl_store_generation() == 0, "legacy acl generation");
+	test_lookups("legacy blob");
+	test_build(ACL_STORE_LEGACY_LEN / 2, false, 50);
+	TEST_CHECK(nvs_get_blob(handle, "acl_1", NULL, &len) == ESP_OK && len == test_ids_len * sizeof(ac_t), "%zu bytes in bank 1", len);
+	TEST_CHECK(acl_store_load() == ESP_OK, "reload");
+	test_lookups("legacy blob rebuilt");
+}
+
+/* overlay saved by a build with a larger CONFIG_ACL_DELTA_MAX is dropped, the generation of the bank is kept */
+static void test_oversized_delta(nvs_handle_t handle)
+{
+	static uint8_t big[TEST_OVERLAY_HEAD + (CONFIG_ACL_DELTA_MAX + 1) * sizeof(acl_store_delta_t)];
+	acl_store_delta_t *entry = (acl_store_delta_t *)(big + TEST_OVERLAY_HEAD);
+	size_t len = 0;
+
+	test_build(test_fit(100), false, 40);
+	memset(big, 0, sizeof(big));
+	entry->record.data[CARD_ID_BYTE_0] = 1;
+	TEST_CHECK(nvs_set_blob(handle, "acl_delta", big, sizeof(big)) == ESP_OK, "set blob");
+	TEST_CHECK(acl_store_load() == ESP_OK, "load with oversized overlay");
+	TEST_CHECK(acl_store_generation() == 40, "generation %u kept", acl_store_generation());
+	TEST_CHECK(nvs_get_blob(handle, "acl_delta", NULL, &len) == ESP_ERR_NVS_NOT_FOUND, "overlay kept");
+	TEST_CHECK(!acl_store_find(1, NULL), "dropped change found");
+	test_lookups("oversized overlay");
+	/* next boot is clean */
+	TEST_CHECK(acl_store_load() == ESP_OK, "reload");
+	/* blob that is not whole entries is dropped too */
+	TEST_CHECK(nvs_set_blob(handle, "acl_delta", big, TEST_OVERLAY_HEAD + sizeof(acl_store_delta_t) + 1) == ESP_OK, "set blob");
+	TEST_CHECK(acl_store_load() == ESP_OK && acl_store_generation() == 40, "load with partial overlay entry");
+	test_lookups("partial overlay entry");
+}
+
+/* power loss after a bank switch but before the overlay was erased, the overlay applies to the previous bank */
+static void test_stale_delta(nvs_handle_t handle)
+{
+	static uint8_t saved[TEST_OVERLAY_HEAD + CONFIG_ACL_DELTA_MAX * sizeof(acl_store_delta_t)];
+	size_t len = sizeof(saved);
+
+	test_build(test_fit(100), false, 50);
+	TEST_CHECK(acl_store_set(1, 3) == ESP_OK, "set");
+	TEST_CHECK(acl_store_save_delta(51) == ESP_OK, "save delta");
+	TEST_CHECK(nvs_get_blob(handle, "acl_delta", saved, &len) == ESP_OK, "read overlay");
+	test_build(test_fit(100), false, 52);
+	TEST_CHECK(nvs_get_blob(handle, "acl_delta", NULL, &len) == ESP_ERR_NVS_NOT_FOUND, "overlay kept after switch");
+	TEST_CHECK(nvs_set_blob(handle, "acl_delta", saved, len) == ESP_OK, "restore overlay");
+	TEST_CHECK(acl_store_load() == ESP_OK, "load with stale overlay");
+	TEST_CHECK(acl_store_generation() == 52, "generation %u of stale overlay", acl_store_generation());
+	TEST_CHECK(!acl_store_find(1, NULL), "stale change found");
+	test_lookups("stale overlay");
+	/* a pending change without a new generation survives a reload */
+	TEST_CHECK(acl_store_set(1, 3) == ESP_OK && acl_store_save_delta(52) == ESP_OK, "save delta");
+	TEST_CHECK(acl_store_load() == ESP_OK && acl_store_find(1, NULL) && acl_store_generation() == 52, "change lost on reload");
+	TEST_CHECK(acl_store_remove(1) == ESP_OK && acl_store_save_delta(52) == ESP_OK, "remove");
+}
+
+/* acl partition flashed after the acl was kept in NVS, the active blob is imported with its generation */
+static void test_import(nvs_handle_t handle)
+{
+	const esp_partition_t *partition = host_partition_create("acl", TEST_PARTITION_SIZE);
+	size_t len = 0;
+
+	test_build(ACL_STORE_LEGACY_LEN / 2, false, 60);
+	TEST_CHECK(acl_store_init(partition, handle) == ESP_OK, "init with partition");
+	TEST_CHECK(acl_store_count() == test_ids_len, "%u cards imported, %zu expected", (unsigned)acl_store_count(), test_ids_len);
+	TEST_CHECK(acl_store_generation() == 60, "generation %u imported", acl_store_generation());
+	TEST_CHECK(nvs_get_blob(handle, "acl", NULL, &len) == ESP_ERR_NVS_NOT_FOUND &&
+			nvs_get_blob(handle, "acl_1", NULL, &len) == ESP_ERR_NVS_NOT_FOUND, "NVS banks kept after import");
+	test_lookups("imported");
+	TEST_CHECK(acl_store_load() == ESP_OK && acl_store_count() == test_ids_len, "reload after import");
+}
+
+int main(void)
+{
+#ifdef TEST_NO_PARTITION
+	/* device updated over the air, partition table without acl partition */
+	const esp_partition_t *partition = NULL;
+#else
+	const esp_partition_t *partition = host_partition_create("acl", TEST_PARTITION_SIZE);
+#endif
+	nvs_handle_t handle;
+
+	nvs_open("access", NVS_READWRITE, &handle);
+	TEST_CHECK(acl_store_init(partition, handle) == ESP_OK, "init");
+	TEST_CHECK(acl_store_count() == 0, "empty store");
+	TEST_CHECK(!acl_store_find(1, NULL), "card found in empty store");
+	if(!partition)
+		test_legacy_blob(handle);
+	test_rebuild();
+	test_delta();
+	test_stats();
+	test_oversized_delta(handle);
+	test_stale_delta(handle);
+	if(!partition)
+		test_import(handle);
+	free(test_ids);
+	if(test_failures)
+	{
+		printf("%d checks failed\n", test_failures);
+		return(EXIT_FAILURE);
+	}
+	printf("all checks passed\n");
+	return(EXIT_SUCCESS);
+}
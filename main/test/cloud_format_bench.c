@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cloud_format.h"
+#include "cloud_format_ref.h"
+
+#define BENCH_BATCHES 4096
+#define BENCH_BATCH_MAX 16
+
+/* counted through -Wl,--wrap=malloc */
+void *__real_malloc(size_t size);
+static size_t bench_allocs;
+
+void *__wrap_malloc(size_t size)
+{
+	bench_allocs++;
+	return(__real_malloc(size));
+}
+
+static uint32_t bench_rand_state = 1;
+static report_data_t bench_reports[BENCH_BATCHES][BENCH_BATCH_MAX];
+static char bench_buf[CLOUD_FORMAT_BATCH_LEN(BENCH_BATCH_MAX) + 1];
+static volatile size_t bench_sink;
+
+static uint32_t bench_rand(void)
+{
+	bench_rand_state ^= bench_rand_state << 13;
+	bench_rand_state ^= bench_rand_state >> 17;
+	bench_rand_state ^= bench_rand_state << 5;
+	return(bench_rand_state);
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/* sizing pass, allocation, formatting pass and free of the cloud manager before */
+static void bench_ref(const report_data_t *reports, size_t count)
+{
+	size_t len = cloud_format_ref_batch(NULL, 0, reports, count);
+	char *buf = malloc(len + 1);
+
+	cloud_format_ref_batch(buf, len + 1, reports, count);
+	bench_sink += buf[len / 2];
+	free(buf);
+}
+
+static void bench_new(const report_data_t *reports, size_t count)
+{
+	bench_sink += cloud_format_batch(bench_buf, reports, count);
+}
+
+static void bench_run(const char *name, void (*format)(const report_data_t *, size_t), size_t count, int rounds)
+{
+	size_t allocs = bench_allocs;
+	double start = bench_now();
+	double elapsed;
+	int round;
+	int i;
+
+	for(round = 0; round < rounds; round++)
+	{
+		for(i = 0; i < BENCH_BATCHES; i++)
+			format(bench_reports[i], count);
+	}
+	elapsed = bench_now() - start;
+	printf("%-7s %2zu reports/batch: %7.1f ns/batch %6.2f Mreports/s %4.1f allocations/batch\n", name, count,
+			elapsed * 1e9 / ((double)rounds * BENCH_BATCHES), (double)rounds * BENCH_BATCHES * count / elapsed / 1e6,
+			(double)(bench_allocs - allocs) / ((double)rounds * BENCH_BATCHES));
+}
+
+/* batch formatting time and allocations against the printf formatter it replaced */
+int main(int argc, char **argv)
+{
+	static const size_t counts[] = {1, 8, 16};
+	int rounds = argc > 1 ? atoi(argv[1]) : 50;
+	size_t i;
+	int n;
+	int j;
+
+	for(n = 0; n < BENCH_BATCHES; n++)
+	{
+		for(j = 0; j < BENCH_BATCH_MAX; j++)
+		{
+			bench_reports[n][j].kind = bench_rand() % REPORT_KIND_MAX;
+			bench_reports[n][j].when = 1700000000 + (time_t)(bench_rand() % 86400);
+			bench_reports[n][j].card_id = ((uint64_t)bench_rand() << 32 | bench_rand()) & 0xFFFFFFFFFFull;
+			bench_reports[n][j].slot_id = (uint8_t)(bench_rand() % 16);
+			bench_reports[n][j].summarised = 0;
+		}
+	}
+	for(i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+	{
+		bench_run("printf", bench_ref, counts[i], rounds);
+		bench_run("format", bench_new, counts[i], rounds);
+	}
+	return(EXIT_SUCCESS);
+}
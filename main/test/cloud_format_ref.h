@@ -0,0 +1,78 @@
+#ifndef CLOUD_FORMAT_REF_H_
+#define CLOUD_FORMAT_REF_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "cloud_format.h"
+
+/* printf based formatter the cloud manager used before, summaries append ",count" */
+
+#define CLOUD_FORMAT_REF_NEW_CARD(r) "%llu,%llu", (unsigned long long)(r)->when, (unsigned long long)(r)->card_id
+#define CLOUD_FORMAT_REF_SLOT_OPEN(r) "%llu,%llu,%d", (unsigned long long)(r)->when, (unsigned long long)(r)->card_id, (r)->slot_id
+
+/* returns formatted batch length, writes nothing if buf is NULL */
+static inline size_t cloud_format_ref_batch(char *buf, size_t size, const report_data_t *reports, size_t count)
+{
+	size_t len = 0;
+	size_t i;
+	bool first_kind = true;
+	bool first_report;
+	report_kind_t kind;
+
+/* appends formatted text if buf is provided */
+#define CLOUD_APPEND(...) len += snprintf(buf ? buf + len : NULL, buf ? size - len : 0, __VA_ARGS__)
+
+	CLOUD_APPEND("{");
+	for(kind = 0; kind < REPORT_KIND_MAX; kind++)
+	{
+		first_report = true;
+		for(i = 0; i < count; i++)
+		{
+			if(reports[i].kind != kind)
+				continue;
+			if(first_report)
+			{
+				CLOUD_APPEND("%s\"%s\":[", first_kind ? "" : ",", cloud_format_path(kind));
+				first_kind = false;
+			}
+			CLOUD_APPEND("%s\"", first_report ? "" : ",");
+			switch(kind)
+			{
+			case REPORT_KIND_SLOT_OPEN:
+				CLOUD_APPEND(CLOUD_FORMAT_REF_SLOT_OPEN(&reports[i]));
+				break;
+			case REPORT_KIND_NEW_CARD:
+				CLOUD_APPEND(CLOUD_FORMAT_REF_NEW_CARD(&reports[i]));
+				break;
+			default:
+				break;
+			}
+			if(reports[i].summarised)
+				CLOUD_APPEND(",%u", reports[i].summarised);
+			CLOUD_APPEND("\"");
+			first_report = false;
+		}
+		if(!first_report)
+			CLOUD_APPEND("]");
+	}
+	CLOUD_APPEND("}");
+
+#undef CLOUD_APPEND
+	return(len);
+}
+
+/* returns formatted single report length, writes nothing if buf is NULL */
+static inline size_t cloud_format_ref_report(char *buf, size_t size, const report_data_t *report)
+{
+	size_t len;
+
+	if(report->kind == REPORT_KIND_SLOT_OPEN)
+		len = snprintf(buf, size, CLOUD_FORMAT_REF_SLOT_OPEN(report));
+	else
+		len = snprintf(buf, size, CLOUD_FORMAT_REF_NEW_CARD(report));
+	if(report->summarised)
+		len += snprintf(buf ? buf + len : NULL, buf ? size - len : 0, ",%u", report->summarised);
+	return(len);
+}
+
+#endif /* CLOUD_FORMAT_REF_H_ */
@@ -0,0 +1,118 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cloud_format.h"
+#include "cloud_format_ref.h"
+
+#define TEST_BATCH_MAX 16
+#define TEST_BATCHES 20000
+
+static int test_failures;
+static uint32_t test_rand_state = 1;
+
+#define TEST_CHECK(cond, ...) do { \
+	if(!(cond)) \
+	{ \
+		printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		test_failures++; \
+	} \
+} while(0)
+
+static uint32_t test_rand(void)
+{
+	test_rand_state ^= test_rand_state << 13;
+	test_rand_state ^= test_rand_state >> 17;
+	test_rand_state ^= test_rand_state << 5;
+	return(test_rand_state);
+}
+
+/* random report, with the extreme values every few reports */
+static void test_random_report(report_data_t *report)
+{
+	memset(report, 0, sizeof(*report));
+	report->kind = test_rand() % REPORT_KIND_MAX;
+	switch(test_rand() % 4)
+	{
+	case 0:
+		report->when = 0;
+		report->card_id = UINT64_MAX;
+		report->slot_id = UINT8_MAX;
+		report->summarised = UINT16_MAX;
+		break;
+	case 1:
+		report->when = (time_t)INT32_MAX;
+		report->card_id = 0;
+		break;
+	default:
+		report->when = (time_t)(test_rand() & 0x7FFFFFFF);
+		report->card_id = ((uint64_t)test_rand() << 32 | test_rand()) >> (test_rand() % 64);
+		report->slot_id = (uint8_t)test_rand();
+		report->summarised = test_rand() % 2 ? 0 : (uint16_t)test_rand();
+		break;
+	}
+}
+
+/* payloads are byte identical to the printf formatter and within the size bound */
+static void test_batches(void)
+{
+	static char buf[CLOUD_FORMAT_BATCH_LEN(TEST_BATCH_MAX) + 1];
+	static char ref[CLOUD_FORMAT_BATCH_LEN(TEST_BATCH_MAX) + 1];
+	report_data_t reports[TEST_BATCH_MAX];
+	size_t count;
+	size_t len;
+	size_t ref_len;
+	size_t i;
+	int n;
+
+	for(n = 0; n < TEST_BATCHES; n++)
+	{
+		count = test_rand() % (TEST_BATCH_MAX + 1);
+		for(i = 0; i < count; i++)
+			test_random_report(&reports[i]);
+		memset(buf, 0x55, sizeof(buf));
+		len = cloud_format_batch(buf, reports, count);
+		ref_len = cloud_format_ref_batch(ref, sizeof(ref), reports, count);
+		TEST_CHECK(len == ref_len && !strcmp(buf, ref), "batch %d of %zu reports\n  got  %s\n  want %s", n, count, buf, ref);
+		TEST_CHECK(len <= CLOUD_FORMAT_BATCH_LEN(count), "batch %d of %zu reports is %zu bytes", n, count, len);
+		for(i = 0; i < count; i++)
+		{
+			len = cloud_format_report(buf, &reports[i]) - buf;
+			buf[len] = '\0';
+			ref_len = cloud_format_ref_report(ref, sizeof(ref), &reports[i]);
+			TEST_CHECK(len == ref_len && !strcmp(buf, ref), "report\n  got  %s\n  want %s", buf, ref);
+			TEST_CHECK(len + 3 <= CLOUD_FORMAT_REPORT_LEN, "report is %zu bytes", len);
+		}
+	}
+}
+
+static void test_fixed(void)
+{
+	char buf[CLOUD_FORMAT_BATCH_LEN(3) + 1];
+	report_data_t reports[3] = {
+		{.kind = REPORT_KIND_NEW_CARD, .when = 1700000000, .card_id = 42},
+		{.kind = REPORT_KIND_SLOT_OPEN, .when = 1700000001, .card_id = 43, .slot_id = 2},
+		{.kind = REPORT_KIND_SLOT_OPEN, .when = 1700000002, .card_id = 44, .slot_id = 3, .summarised = 12},
+	};
+
+	TEST_CHECK(cloud_format_batch(buf, reports, 0) == 2 && !strcmp(buf, "{}"), "empty batch %s", buf);
+	cloud_format_batch(buf, reports, 3);
+	TEST_CHECK(!strcmp(buf, "{\"slotOpen\":[\"1700000001,43,2\",\"1700000002,44,3,12\"],\"newCard\":[\"1700000000,42\"]}"), "batch %s", buf);
+	TEST_CHECK(!strcmp(cloud_format_path(REPORT_KIND_SLOT_OPEN), "slotOpen") && !strcmp(cloud_format_path(REPORT_KIND_NEW_CARD), "newCard"), "paths");
+}
+
+int main(void)
+{
+	test_fixed();
+	test_batches();
+	if(test_failures)
+	{
+		printf("%d checks failed\n", test_failures);
+		return(EXIT_FAILURE);
+	}
+	printf("all checks passed\n");
+	return(EXIT_SUCCESS);
+}
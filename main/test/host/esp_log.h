@@ -0,0 +1,13 @@
+#ifndef HOST_ESP_LOG_H_
+#define HOST_ESP_LOG_H_
+
+#include <stdio.h>
+
+/* host stand-in for the IDF header, errors and warnings go to stderr, the rest is dropped */
+
+#define ESP_LOGE(tag, format, ...) fprintf(stderr, "E %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) fprintf(stderr, "W %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) do { (void)(tag); } while(0)
+#define ESP_LOGD(tag, format, ...) do { (void)(tag); } while(0)
+
+#endif /* HOST_ESP_LOG_H_ */
@@ -0,0 +1,19 @@
+#ifndef HOST_ESP_SPI_FLASH_H_
+#define HOST_ESP_SPI_FLASH_H_
+
+#include <stdint.h>
+
+/* host stand-in for the IDF v4.4 header */
+
+#define SPI_FLASH_SEC_SIZE 4096
+
+typedef enum {
+	SPI_FLASH_MMAP_DATA,
+	SPI_FLASH_MMAP_INST
+} spi_flash_mmap_memory_t;
+
+typedef uint32_t spi_flash_mmap_handle_t;
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle);
+
+#endif /* HOST_ESP_SPI_FLASH_H_ */
@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/semphr.h"
+#include "esp_spi_flash.h"
+#include "nvs.h"
+#include "host_fake.h"
+
+/*
+
+RAM backed flash partitions and NVS namespace. Flash behaves like NOR flash,
+erase sets whole sectors to 0xFF and writes can only clear bits, anything else
+aborts the test. NVS keeps one namespace, blobs are copied on set and get.
+
+*/
+
+#define HOST_NVS_KEYS 32
+#define HOST_NVS_KEY_LEN 16
+#define HOST_NVS_BLOB_MAX (64 * 1024)
+
+typedef struct {
+	esp_partition_t partition;
+	uint8_t *data;
+} host_partition_t;
+
+typedef struct {
+	char key[HOST_NVS_KEY_LEN];
+	uint8_t *value;
+	size_t len;
+} host_nvs_entry_t;
+
+struct host_mutex {
+	int held;
+};
+
+static host_nvs_entry_t host_nvs[HOST_NVS_KEYS];
+static host_fake_stats_t host_stats;
+
+static void host_fail(const char *what)
+{
+	fprintf(stderr, "host fake: %s\n", what);
+	abort();
+}
+
+static host_partition_t *host_partition(const esp_partition_t *partition)
+{
+	if(!partition)
+		host_fail("NULL partition");
+	return((host_partition_t *)partition);
+}
+
+const esp_partition_t *host_partition_create(const char *label, size_t size)
+{
+	host_partition_t *part = calloc(1, sizeof(host_partition_t));
+
+	if(!part || size % SPI_FLASH_SEC_SIZE)
+		host_fail("partition create");
+	part->data = malloc(size);
+	if(!part->data)
+		host_fail("partition create");
+	memset(part->data, 0xFF, size);
+	part->partition.size = (uint32_t)size;
+	strncpy(part->partition.label, label, sizeof(part->partition.label) - 1);
+	return(&part->partition);
+}
+
+void host_partition_destroy(const esp_partition_t *partition)
+{
+	host_partition_t *part = host_partition(partition);
+
+	free(part->data);
+	free(part);
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+	host_partition_t *part = host_partition(partition);
+
+	if(offset % SPI_FLASH_SEC_SIZE || size % SPI_FLASH_SEC_SIZE || offset + size > partition->size)
+		host_fail("erase out of range or unaligned");
+	memset(part->data + offset, 0xFF, size);
+	host_stats.erases++;
+	return(ESP_OK);
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+	host_partition_t *part = host_partition(partition);
+	const uint8_t *data = src;
+	size_t i;
+
+	if(dst_offset + size > partition->size)
+		host_fail("write out of range");
+	for(i = 0; i < size; i++)
+	{
+		if((part->data[dst_offset + i] & data[i]) != data[i])
+			host_fail("write to unerased flash");
+		part->data[dst_offset + i] = data[i];
+	}
+	host_stats.writes++;
+	return(ESP_OK);
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+	host_partition_t *part = host_partition(partition);
+
+	if(src_offset + size > partition->size)
+		host_fail("read out of range");
+	memcpy(dst, part->data + src_offset, size);
+	return(ESP_OK);
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset, size_t size, spi_flash_mmap_memory_t memory, const void **out_ptr, spi_flash_mmap_handle_t *out_handle)
+{
+	host_partition_t *part = host_partition(partition);
+
+	(void)memory;
+	if(offset + size > partition->size)
+		host_fail("mmap out of range");
+	*out_ptr = part->data + offset;
+	*out_handle = 1;
+	return(ESP_OK);
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle)
+{
+	if(!handle)
+		host_fail("munmap of invalid handle");
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+	return(calloc(1, sizeof(struct host_mutex)));
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+	(void)ticks;
+	if(!semaphore)
+		host_fail("take of NULL mutex");
+	if(semaphore->held)
+		host_fail("mutex taken twice");
+	semaphore->held = 1;
+	return(pdTRUE);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+	if(!semaphore)
+		host_fail("give of NULL mutex");
+	if(!semaphore->held)
+		return(pdFALSE);
+	semaphore->held = 0;
+	return(pdTRUE);
+}
+
+static host_nvs_entry_t *host_nvs_find(const char *key, int create)
+{
+	host_nvs_entry_t *free_entry = NULL;
+	int i;
+
+	if(strlen(key) >= HOST_NVS_KEY_LEN)
+		host_fail("NVS key too long");
+	for(i = 0; i < HOST_NVS_KEYS; i++)
+	{
+		if(host_nvs[i].value && !strcmp(host_nvs[i].key, key))
+			return(&host_nvs[i]);
+		if(!host_nvs[i].value && !free_entry)
+			free_entry = &host_nvs[i];
+	}
+	if(!create)
+		return(NULL);
+	if(!free_entry)
+		host_fail("NVS full");
+	strcpy(free_entry->key, key);
+	return(free_entry);
+}
+
+void host_nvs_clear(void)
+{
+	int i;
+
+	for(i = 0; i < HOST_NVS_KEYS; i++)
+	{
+		free(host_nvs[i].value);
+		host_nvs[i].value = NULL;
+	}
+}
+
+void host_fake_get_stats(host_fake_stats_t *stats)
+{
+	*stats = host_stats;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+	(void)name;
+	(void)open_mode;
+	*out_handle = 1;
+	return(ESP_OK);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+	host_nvs_entry_t *entry = host_nvs_find(key, 0);
+
+	(void)handle;
+	if(!entry)
+		return(ESP_ERR_NVS_NOT_FOUND);
+	if(out_value)
+	{
+		if(*length < entry->len)
+			return(ESP_ERR_INVALID_SIZE);
+		memcpy(out_value, entry->value, entry->len);
+	}
+	*length = entry->len;
+	return(ESP_OK);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+	host_nvs_entry_t *entry = host_nvs_find(key, 1);
+	uint8_t *copy = malloc(length ? length : 1);
+
+	(void)handle;
+	if(!copy || length > HOST_NVS_BLOB_MAX)
+		host_fail("NVS blob set");
+	memcpy(copy, value, length);
+	free(entry->value);
+	entry->value = copy;
+	entry->len = length;
+	host_stats.nvs_sets++;
+	return(ESP_OK);
+}
+
+/* integers are blobs of their size, a size mismatch reads as a missing key like on the target */
+static esp_err_t host_nvs_get_int(const char *key, void *out_value, size_t size)
+{
+	host_nvs_entry_t *entry = host_nvs_find(key, 0);
+
+	if(!entry || entry->len != size)
+		return(ESP_ERR_NVS_NOT_FOUND);
+	memcpy(out_value, entry->value, size);
+	return(ESP_OK);
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *out_value)
+{
+	(void)handle;
+	return(host_nvs_get_int(key, out_value, sizeof(*out_value)));
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value)
+{
+	return(nvs_set_blob(handle, key, &value, sizeof(value)));
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value)
+{
+	(void)handle;
+	return(host_nvs_get_int(key, out_value, sizeof(*out_value)));
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+	return(nvs_set_blob(handle, key, &value, sizeof(value)));
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+	host_nvs_entry_t *entry = host_nvs_find(key, 0);
+
+	(void)handle;
+	if(!entry)
+		return(ESP_ERR_NVS_NOT_FOUND);
+	free(entry->value);
+	entry->value = NULL;
+	return(ESP_OK);
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+	(void)handle;
+	host_stats.nvs_commits++;
+	return(ESP_OK);
+}
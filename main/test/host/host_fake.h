@@ -0,0 +1,21 @@
+#ifndef HOST_FAKE_H_
+#define HOST_FAKE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_partition.h"
+
+/* flash and NVS operation counters */
+typedef struct {
+	uint32_t erases;
+	uint32_t writes;
+	uint32_t nvs_sets;
+	uint32_t nvs_commits;
+} host_fake_stats_t;
+
+const esp_partition_t *host_partition_create(const char *label, size_t size);
+void host_partition_destroy(const esp_partition_t *partition);
+void host_nvs_clear(void);
+void host_fake_get_stats(host_fake_stats_t *stats);
+
+#endif /* HOST_FAKE_H_ */
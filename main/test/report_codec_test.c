@@ -0,0 +1,253 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "report_codec.h"
+
+#define TEST_GROUP_MAX 16
+#define TEST_GROUPS 100000
+
+static int test_failures;
+static uint32_t test_rand_state = 1;
+
+#define TEST_CHECK(cond, ...) do { \
+	if(!(cond)) \
+	{ \
+		printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		test_failures++; \
+	} \
+} while(0)
+
+/* xorshift32, same sequence on every host */
+static uint32_t test_rand(void)
+{
+	test_rand_state ^= test_rand_state << 13;
+	test_rand_state ^= test_rand_state >> 17;
+	test_rand_state ^= test_rand_state << 5;
+	return(test_rand_state);
+}
+
+static bool test_same(const report_data_t *a, const report_data_t *b)
+{
+	return(a->kind == b->kind && a->when == b->when && a->card_id == b->card_id &&
+			a->slot_id == b->slot_id && a->summarised == b->summarised);
+}
+
+/* random report, slot is only stored for slot opens */
+static void test_random_report(report_data_t *report, time_t base)
+{
+	memset(report, 0, sizeof(*report));
+	report->kind = test_rand() % REPORT_KIND_MAX;
+	report->when = base + (time_t)(test_rand() % 7200) - 3600;
+	switch(test_rand() % 3)
+	{
+	case 0:
+		report->card_id = test_rand() & 0xFF;
+		break;
+	case 1:
+		report->card_id = ((uint64_t)test_rand() << 8 | (test_rand() & 0xFF)) & 0xFFFFFFFFFFull;
+		break;
+	default:
+		report->card_id = (uint64_t)test_rand() << 32 | test_rand();
+		break;
+	}
+	if(report->kind == REPORT_KIND_SLOT_OPEN)
+		report->slot_id = (uint8_t)test_rand();
+	if(!(test_rand() % 4))
+		report->summarised = (uint16_t)(1 + test_rand() % UINT16_MAX);
+}
+
+static size_t test_round_trip(const report_data_t *reports, size_t count, uint8_t *buf, size_t size)
+{
+	report_data_t decoded[TEST_GROUP_MAX];
+	uint32_t errors = 0;
+	size_t len;
+	size_t n;
+	size_t i;
+
+	len = report_codec_encode(buf, size, reports, count);
+	TEST_CHECK(len, "%zu reports not encoded", count);
+	n = report_codec_decode(buf, len, decoded, TEST_GROUP_MAX, &errors);
+	TEST_CHECK(n == count && !errors, "%zu of %zu reports decoded, %u errors", n, count, errors);
+	for(i = 0; i < n && i < count; i++)
+		TEST_CHECK(test_same(&decoded[i], &reports[i]), "report %zu of %zu differs", i, count);
+	return(len);
+}
+
+static void test_fields(void)
+{
+	uint8_t buf[REPORT_CODEC_ENTRY_SIZE(TEST_GROUP_MAX)];
+	report_data_t reports[4];
+
+	memset(reports, 0, sizeof(reports));
+	/* short id, fits 5 bytes */
+	reports[0].kind = REPORT_KIND_SLOT_OPEN;
+	reports[0].when = 1700000000;
+	reports[0].card_id = 0xFFFFFFFFFFull;
+	reports[0].slot_id = 7;
+	/* long id and time going backwards */
+	reports[1].kind = REPORT_KIND_NEW_CARD;
+	reports[1].when = 1699999000;
+	reports[1].card_id = 0x0100000000000000ull;
+	/* largest id and large forward step */
+	reports[2].kind = REPORT_KIND_SLOT_OPEN;
+	reports[2].when = 1800000000;
+	reports[2].card_id = UINT64_MAX;
+	reports[2].slot_id = 255;
+	/* summary with time before the first record */
+	reports[3].kind = REPORT_KIND_SLOT_OPEN;
+	reports[3].when = 0;
+	reports[3].card_id = 1;
+	reports[3].slot_id = 1;
+	reports[3].summarised = UINT16_MAX;
+	test_round_trip(reports, 4, buf, sizeof(buf));
+	/* short id record is 15 bytes first, 9 after, long id adds 3 */
+	TEST_CHECK(report_codec_encode(buf, sizeof(buf), reports, 1) == 2 + 1 + 5 + 5 + 1 + 1, "first short id record size");
+	reports[1] = reports[0];
+	reports[1].when += 60;
+	TEST_CHECK(report_codec_encode(buf, sizeof(buf), reports, 2) == 2 + 13 + 1 + 1 + 5 + 1 + 1, "following short id record size");
+	/* empty group is a valid entry */
+	TEST_CHECK(test_round_trip(reports, 0, buf, sizeof(buf)) == 2, "empty entry size");
+	/* short buffer fails instead of overflowing */
+	TEST_CHECK(!report_codec_encode(buf, 14, reports, 1), "record encoded into short buffer");
+	TEST_CHECK(!report_codec_encode(buf, 1, reports, 0), "header encoded into short buffer");
+}
+
+static void test_random(void)
+{
+	uint8_t buf[REPORT_CODEC_ENTRY_SIZE(TEST_GROUP_MAX)];
+	report_data_t reports[TEST_GROUP_MAX];
+	time_t base;
+	size_t count;
+	size_t i;
+	int n;
+
+	for(n = 0; n < TEST_GROUPS; n++)
+	{
+		count = 1 + test_rand() % TEST_GROUP_MAX;
+		base = (time_t)(test_rand() & 0x7FFFFFFF);
+		for(i = 0; i < count; i++)
+			test_random_report(&reports[i], base);
+		test_round_trip(reports, count, buf, sizeof(buf));
+	}
+}
+
+/* entries of older firmware are raw report_data_t structs */
+static void test_legacy(void)
+{
+	report_data_t legacy[3];
+	report_data_t decoded[TEST_GROUP_MAX];
+	uint8_t buf[sizeof(legacy) + 1];
+	uint32_t errors = 0;
+	size_t n;
+	size_t i;
+
+	for(i = 0; i < 3; i++)
+	{
+		memset(&legacy[i], 0, sizeof(legacy[i]));
+		legacy[i].kind = i % REPORT_KIND_MAX;
+		legacy[i].when = 1600000000 + (time_t)i;
+		legacy[i].card_id = 0x1234567890ull + i;
+		legacy[i].slot_id = (uint8_t)i;
+		legacy[i].summarised = 0xBEEF; /* padding in the old layout, must be ignored */
+	}
+	memcpy(buf, legacy, sizeof(legacy));
+	n = report_codec_decode(buf, sizeof(legacy), decoded, TEST_GROUP_MAX, &errors);
+	TEST_CHECK(n == 3 && !errors, "%zu legacy reports decoded, %u errors", n, errors);
+	for(i = 0; i < n; i++)
+	{
+		legacy[i].summarised = 0;
+		TEST_CHECK(test_same(&decoded[i], &legacy[i]), "legacy report %zu differs", i);
+	}
+	/* size not a multiple of the struct */
+	errors = 0;
+	n = report_codec_decode(buf, sizeof(legacy) + 1, decoded, TEST_GROUP_MAX, &errors);
+	TEST_CHECK(!n && errors == 1, "odd sized legacy entry, %zu decoded, %u errors", n, errors);
+	/* unknown kind is dropped, the rest kept */
+	legacy[1].kind = REPORT_KIND_MAX;
+	memcpy(buf, legacy, sizeof(legacy));
+	errors = 0;
+	n = report_codec_decode(buf, sizeof(legacy), decoded, TEST_GROUP_MAX, &errors);
+	TEST_CHECK(n == 2 && errors == 1, "legacy entry with bad kind, %zu decoded, %u errors", n, errors);
+	/* more structs than room */
+	errors = 0;
+	n = report_codec_decode(buf, sizeof(legacy), decoded, 1, &errors);
+	TEST_CHECK(n == 1 && errors == 2, "legacy entry over max, %zu decoded, %u errors", n, errors);
+}
+
+/* truncation and corruption keep the records before the damage and are counted */
+static void test_damaged(void)
+{
+	uint8_t buf[REPORT_CODEC_ENTRY_SIZE(TEST_GROUP_MAX)];
+	uint8_t bad[REPORT_CODEC_ENTRY_SIZE(TEST_GROUP_MAX)];
+	report_data_t reports[TEST_GROUP_MAX];
+	report_data_t decoded[TEST_GROUP_MAX];
+	size_t ends[TEST_GROUP_MAX];
+	uint32_t errors;
+	size_t count = 8;
+	size_t len;
+	size_t cut;
+	size_t bit;
+	size_t n;
+	size_t i;
+	size_t whole;
+
+	for(i = 0; i < count; i++)
+	{
+		test_random_report(&reports[i], 1700000000);
+		ends[i] = report_codec_encode(buf, sizeof(buf), reports, i + 1);
+	}
+	len = ends[count - 1];
+	for(cut = 0; cut < len; cut++)
+	{
+		errors = 0;
+		n = report_codec_decode(buf, cut, decoded, TEST_GROUP_MAX, &errors);
+		for(whole = 0; whole < count && ends[whole] <= cut; whole++)
+			;
+		TEST_CHECK(n == whole, "cut at %zu: %zu decoded, %zu whole records", cut, n, whole);
+		TEST_CHECK(errors == (cut != 2 && (!whole || cut != ends[whole - 1])), "cut at %zu: %u errors", cut, errors);
+		for(i = 0; i < n; i++)
+			TEST_CHECK(test_same(&decoded[i], &reports[i]), "cut at %zu: report %zu differs", cut, i);
+	}
+	/* every single bit flip after the header is detected, earlier records survive */
+	for(bit = 16; bit < 8 * len; bit++)
+	{
+		memcpy(bad, buf, len);
+		bad[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+		errors = 0;
+		n = report_codec_decode(bad, len, decoded, TEST_GROUP_MAX, &errors);
+		for(whole = 0; whole < count && ends[whole] <= bit / 8; whole++)
+			;
+		TEST_CHECK(n == whole && errors == 1, "bit %zu: %zu decoded, %zu before damage, %u errors", bit, n, whole, errors);
+		for(i = 0; i < n; i++)
+			TEST_CHECK(test_same(&decoded[i], &reports[i]), "bit %zu: report %zu differs", bit, i);
+	}
+	/* unknown version is skipped, not misread */
+	memcpy(bad, buf, len);
+	bad[1] = REPORT_CODEC_VERSION + 1;
+	errors = 0;
+	n = report_codec_decode(bad, len, decoded, TEST_GROUP_MAX, &errors);
+	TEST_CHECK(!n && errors == 1, "unknown version, %zu decoded, %u errors", n, errors);
+	/* decoding stops at max, the rest is counted */
+	errors = 0;
+	n = report_codec_decode(buf, len, decoded, 3, &errors);
+	TEST_CHECK(n == 3 && errors == 1, "over max, %zu decoded, %u errors", n, errors);
+}
+
+int main(void)
+{
+	test_fields();
+	test_random();
+	test_legacy();
+	test_damaged();
+	if(test_failures)
+	{
+		printf("%d checks failed\n", test_failures);
+		return(EXIT_FAILURE);
+	}
+	printf("all checks passed\n");
+	return(EXIT_SUCCESS);
+}